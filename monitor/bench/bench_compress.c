@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (bench_compress.c)
+ *
+ * Size of the reply to an unfiltered query (every node's blob, as
+ * wwstats gets it) and ms to compress & decompress it, with every codec
+ * the aggregator was built with.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "nodetable.h"
+#include "compress.h"
+#include "sample.h"
+
+#define ROUNDS 5
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+run(int nnodes)
+{
+  static const int flags[] = { APPHDR_LZ4, APPHDR_ZSTD, APPHDR_ZLIB };
+  char nodename[MAX_NODENAME_LEN];
+  nodetable nt;
+  time_t ts = time(NULL);
+
+  if (nodetable_init(&nt) < 0) exit(1);
+  for (int i = 0; i < nnodes; i++) {
+    snprintf(nodename, MAX_NODENAME_LEN, "n%05d", i);
+    json_object *jobj = sample_full(nodename, ts, i);
+    nodetable_update(&nt, nodename, ts, jobj);
+  }
+
+  json_object *reply = json_object_new_object();
+  nodetable_dump(&nt, reply);
+  const char *json = json_object_to_json_string(reply);
+  size_t len = strlen(json);
+  printf("%6d nodes %-6s %10zu bytes\n", nnodes, "none", len);
+
+  for (int c = 0; c < sizeof(flags) / sizeof(flags[0]); c++) {
+    char *out = NULL, *back = NULL;
+    size_t outlen = 0, backlen = 0;
+    double comp, decomp;
+
+    if (compress_name(flags[c]) == NULL) continue;
+
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+      free(out);
+      out = NULL;
+      if (compress_frame(flags[c], json, len, &out, &outlen) != flags[c]) {
+        fprintf(stderr, "%s did not compress\n", compress_name(flags[c]));
+        exit(1);
+      }
+    }
+    comp = (now() - start) / ROUNDS;
+
+    start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+      free(back);
+      if ((back = decompress_frame(flags[c], out, outlen, &backlen)) == NULL ||
+          backlen != len || memcmp(back, json, len) != 0) {
+        fprintf(stderr, "%s did not decompress\n", compress_name(flags[c]));
+        exit(1);
+      }
+    }
+    decomp = (now() - start) / ROUNDS;
+
+    printf("%6s       %-6s %10zu bytes %6.1fx %8.2f ms to compress %8.2f ms to decompress\n", "",
+           compress_name(flags[c]), outlen, (double) len / outlen, comp * 1000, decomp * 1000);
+    free(out);
+    free(back);
+  }
+  json_object_put(reply);
+}
+
+int
+main(int argc, char *argv[])
+{
+  run(1000);
+  run(10000);
+  return(0);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (bench_delta.c)
+ *
+ * Bytes on the wire and packets/second the aggregator parses, and parses
+ * & merges into the node table, for idle nodes: every collector sending
+ * all its metrics, against sending only what moved past its threshold
+ * (TIMESTAMP and CPUUTIL).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "nodetable.h"
+#include "sample.h"
+
+#define NODES 10000
+#define ROUNDS 5
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// What wwmon_collector sends of an idle node, all of it or the changes
+static char *
+make_packet(char *nodename, time_t timestamp, int seq, int delta)
+{
+  json_object *jobj = delta ? sample_delta(timestamp, seq) : sample_full(nodename, timestamp, seq);
+  char *str = strdup(json_object_to_json_string(jobj));
+
+  json_object_put(jobj);
+  return(str);
+}
+
+// Parse (& merge, given nt) ROUNDS packets of every node, as readHandler() does
+static double
+run(nodetable *nt, time_t ts, int delta, double *bytes)
+{
+  char nodename[MAX_NODENAME_LEN];
+  char **pkts = malloc(NODES * ROUNDS * sizeof(char *));
+  size_t total = 0;
+
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < NODES; i++) {
+      snprintf(nodename, MAX_NODENAME_LEN, "n%05d", i);
+      pkts[r * NODES + i] = make_packet(nodename, ts + 2 * r, i + r, delta);
+      total += sizeof(apphdr) + strlen(pkts[r * NODES + i]);
+    }
+  }
+
+  double start = now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < NODES; i++) {
+      snprintf(nodename, MAX_NODENAME_LEN, "n%05d", i);
+      json_object *jobj = json_tokener_parse(pkts[r * NODES + i]);
+      if (nt != NULL) nodetable_update(nt, nodename, ts + 2 * r, jobj);
+      else json_object_put(jobj);
+    }
+  }
+  double secs = now() - start;
+
+  for (int i = 0; i < NODES * ROUNDS; i++) free(pkts[i]);
+  free(pkts);
+  *bytes = (double) total / (NODES * ROUNDS);
+  return(NODES * ROUNDS / secs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  nodetable nt;
+  double full_bytes, delta_bytes;
+  time_t ts = time(NULL);
+
+  if (nodetable_init(&nt) < 0) exit(1);
+
+  // Every node reported in full once already
+  run(&nt, ts - 100, 0, &full_bytes);
+
+  double full_parse = run(NULL, ts, 0, &full_bytes);
+  double delta_parse = run(NULL, ts, 1, &delta_bytes);
+  double full = run(&nt, ts, 0, &full_bytes);
+  double delta = run(&nt, ts + 2 * ROUNDS, 1, &delta_bytes);
+
+  printf("%8s %12s %16s %16s\n", "", "bytes/pkt", "parse (pkts/s)", "+merge (pkts/s)");
+  printf("%8s %12.0f %16.0f %16.0f\n", "full", full_bytes, full_parse, full);
+  printf("%8s %12.0f %16.0f %16.0f\n", "delta", delta_bytes, delta_parse, delta);
+  return(0);
+}
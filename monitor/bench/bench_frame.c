@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (bench_frame.c)
+ *
+ * Compares the frame decoder against the old strcat() accumulation of
+ * readHandler()/recvall() for query responses of growing size. Both are
+ * fed the same stream in recv sized chunks, so only decode cost counts.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "util.h"
+
+// What a recv of MAXPKTSIZE-1 bytes hands back on a busy socket
+#define CHUNK (MAXPKTSIZE-1)
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// Header plus a payload of len printable bytes
+static char *
+make_stream(int len)
+{
+  char *stream = malloc(sizeof(apphdr) + len);
+  apphdr *app_h = (apphdr *) stream;
+
+  bzero(app_h, sizeof(apphdr));
+  app_h->len = len;
+  app_h->timestamp = time(NULL);
+  strcpy(app_h->nodename, "bench");
+  for (int i = 0; i < len; i++) {
+    stream[sizeof(apphdr) + i] = 'a' + i % 26;
+  }
+  return(stream);
+}
+
+// The old way: header from the first chunk, then strcat every chunk
+static char *
+legacy_decode(const char *stream, int total)
+{
+  char rbuf[MAXPKTSIZE];
+  apphdr *app_h = (apphdr *) stream;
+  char *buffer = malloc(app_h->len + 1);
+  int off = sizeof(apphdr);
+
+  buffer[0] = '\0';
+  while (off < total) {
+    int n = (total - off < CHUNK) ? total - off : CHUNK;
+    memcpy(rbuf, stream + off, n);
+    rbuf[n] = '\0';
+    strcat(buffer, rbuf);
+    off += n;
+  }
+  return(buffer);
+}
+
+static char *
+decoder_decode(const char *stream, int total)
+{
+  framedec d;
+  int off = 0, used, rc = FRAME_MORE;
+
+  bzero(&d, sizeof(d));
+  while (off < total && rc == FRAME_MORE) {
+    int n = (total - off < CHUNK) ? total - off : CHUNK;
+    rc = frame_feed(&d, stream + off, n, &used);
+    off += used;
+  }
+  if (rc != FRAME_DONE) {
+    fprintf(stderr, "frame_feed failed\n");
+    exit(1);
+  }
+  return(frame_take(&d));
+}
+
+static double
+run(char *(*decode)(const char *, int), const char *stream, int total, int reps)
+{
+  double start = now();
+  for (int i = 0; i < reps; i++) {
+    char *payload = decode(stream, total);
+    if (strlen(payload) != total - sizeof(apphdr)) {
+      fprintf(stderr, "decoded payload has the wrong size\n");
+      exit(1);
+    }
+    free(payload);
+  }
+  return((now() - start) / reps);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int sizes[] = { 64*1024, 256*1024, 1024*1024, 4*1024*1024, 8*1024*1024 };
+
+  printf("%10s %14s %14s %14s\n", "payload", "strcat (ms)", "decoder (ms)", "decoder ns/B");
+  for (int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    int total = sizeof(apphdr) + sizes[i];
+    char *stream = make_stream(sizes[i]);
+    int reps = sizes[i] > 1024*1024 ? 1 : 5;
+
+    double t_legacy = run(legacy_decode, stream, total, reps);
+    double t_decoder = run(decoder_decode, stream, total, 20);
+
+    printf("%10d %14.3f %14.3f %14.3f\n", sizes[i], t_legacy * 1e3,
+           t_decoder * 1e3, t_decoder * 1e9 / sizes[i]);
+    free(stream);
+  }
+  return(0);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (bench_ingest.c)
+ *
+ * Packets/second of the aggregator's SQLite write path for a cluster of
+ * simulated nodes: the old sqlite3_exec() per statement update_dbase()
+ * against dbstore's prepared statements batched per tick. Both run on
+ * a datastore already holding every node, as in steady state.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <json/json.h>
+#include <sqlite3.h>
+
+#include "globals.h"
+#include "util.h"
+#include "dbstore.h"
+#include "sample.h"
+
+// Don't wait forever on the old path, it gets slower as nodes are added
+#define LEGACY_SECS 5
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// update_dbase() as the aggregator used to have it
+static void
+legacy_update(sqlite3 *db, time_t TimeStamp, char *NodeName, json_object *jobj)
+{
+  int DBTimeStamp = -1;
+  int blobid = -1;
+
+  if ( (DBTimeStamp = NodeTS_fromDB(NodeName, db)) == -1 ) {
+    insert_json(NodeName, TimeStamp, jobj, db);
+    blobid = NodeBID_fromDB(NodeName, db);
+    insertLookups(blobid, jobj, db);
+  } else {
+    blobid = NodeBID_fromDB(NodeName, db);
+    update_insertLookups(blobid, jobj, db, DBTimeStamp < TimeStamp);
+    merge_json(NodeName, TimeStamp, jobj, db, DBTimeStamp < TimeStamp);
+  }
+}
+
+static double
+run_legacy(sqlite3 *db, int nodes, time_t ts)
+{
+  char nodename[MAX_NODENAME_LEN];
+  int pkts = 0;
+  double start = now();
+
+  while (pkts < nodes && now() - start < LEGACY_SECS) {
+    snprintf(nodename, MAX_NODENAME_LEN, "n%05d", pkts);
+    json_object *jobj = sample_full(nodename, ts, pkts);
+    legacy_update(db, ts, nodename, jobj);
+    json_object_put(jobj);
+    pkts++;
+  }
+  return(pkts / (now() - start));
+}
+
+static double
+run_dbstore(dbstore *ds, int nodes, time_t ts)
+{
+  char nodename[MAX_NODENAME_LEN];
+  double start = now();
+
+  for (int i = 0; i < nodes; i++) {
+    snprintf(nodename, MAX_NODENAME_LEN, "n%05d", i);
+    json_object *jobj = sample_full(nodename, ts, i);
+    dbstore_update(ds, nodename, ts, jobj);
+    json_object_put(jobj);
+    dbstore_tick(ds, time(NULL));
+  }
+  dbstore_commit(ds);
+  return(nodes / (now() - start));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int sizes[] = { 1000, 10000 };
+  char path[] = "/tmp/bench_ingest.XXXXXX";
+
+  printf("%8s %18s %18s\n", "nodes", "legacy (pkts/s)", "dbstore (pkts/s)");
+  for (int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    sqlite3 *db;
+    dbstore ds;
+    int fd;
+    time_t ts = time(NULL);
+
+    strcpy(path, "/tmp/bench_ingest.XXXXXX");
+    if ((fd = mkstemp(path)) < 0 || sqlite3_open(path, &db) != SQLITE_OK) {
+      perror(path);
+      exit(1);
+    }
+    close(fd);
+    createTable(db, SQLITE_DB_TB1NAME);
+    createTable(db, SQLITE_DB_TB2NAME);
+    dbstore_open(&ds, db);
+
+    // Every node reported once already
+    run_dbstore(&ds, sizes[i], ts);
+
+    double legacy = run_legacy(db, sizes[i], ts + 1);
+    double batched = run_dbstore(&ds, sizes[i], ts + 2);
+    printf("%8d %18.0f %18.0f\n", sizes[i], legacy, batched);
+
+    dbstore_close(&ds);
+    sqlite3_close(db);
+    unlink(path);
+  }
+  return(0);
+}
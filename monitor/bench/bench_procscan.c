@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (bench_procscan.c)
+ *
+ * ns per parse of /proc/stat, meminfo, net/dev, loadavg and diskstats,
+ * with the scanners of procscan.c and with fgets() + strtok() + atoll()
+ * the way getstats.c used to. The files are snapshots: those in the
+ * directory given (copies of /proc taken on some node, net/dev as
+ * net_dev), else this host's own plus a /proc/stat, net/dev and
+ * diskstats made up for a 256 core node with 64 interfaces and 256 disks.
+ *
+ */
+
+#define _GNU_SOURCE  // fmemopen()
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "procscan.h"
+
+#define ROUNDS 20000
+#define MAXCPU 1024
+#define MAXDEV 1024
+
+typedef struct snapshot {
+  char *buf;
+  size_t len;
+} snapshot;
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static char *
+slurp(const char *path, size_t *len)
+{
+  FILE *fp = fopen(path, "r");
+  char *buf = NULL;
+  size_t size = 0, n;
+
+  *len = 0;
+  if (fp == NULL) return(NULL);
+  do {
+    size = size ? size * 2 : 65536;
+    buf = realloc(buf, size + 1);
+    n = fread(buf + *len, 1, size - *len, fp);
+    *len += n;
+  } while (*len == size);
+  buf[*len] = '\0';
+  fclose(fp);
+  return(buf);
+}
+
+// A growing string to make up snapshots in
+static char *
+append(char *buf, size_t *len, const char *fmt, ...)
+{
+  char line[8192];
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  buf = realloc(buf, *len + n + 1);
+  memcpy(buf + *len, line, n + 1);
+  *len += n;
+  return(buf);
+}
+
+static void
+make_stat(snapshot *s, int ncpu)
+{
+  size_t len = 0;
+  char *buf = append(NULL, &len, "cpu  %d %d %d %d %d %d %d %d 0 0\n",
+                     90557123, 1234, 27057456, 420495789, 2421, 0, 78123, 2342);
+  for (int c = 0; c < ncpu; c++)
+    buf = append(buf, &len, "cpu%d %d %d %d %d %d %d %d %d 0 0\n", c,
+                 353000 + c * 17, c % 7, 105000 + c * 3, 1642000 + c * 11, 9 + c, 0, 305 + c, 9);
+  buf = append(buf, &len, "intr 67199812");
+  for (int i = 0; i < 4096; i++) buf = append(buf, &len, " %d", (i * 7919) % 5 ? 0 : i * 131);
+  buf = append(buf, &len, "\nctxt 2235664123\nbtime 1792210391\nprocesses 158530\n"
+               "procs_running 2\nprocs_blocked 0\nsoftirq 633457 0 164877 2 175521 0 0 1 0 169 292887\n");
+  s->buf = buf;
+  s->len = len;
+}
+
+static void
+make_netdev(snapshot *s, int nifs)
+{
+  size_t len = 0;
+  char *buf = append(NULL, &len, "Inter-|   Receive                                                |  Transmit\n"
+                     " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n");
+  for (int i = 0; i < nifs; i++)
+    buf = append(buf, &len, "%6s%d: %llu %llu 0 0 0 0 0 0 %llu %llu 0 0 0 0 0 0\n", i ? "ib" : "lo", i,
+                 123456789012ull + i, 98765432ull + i, 223456789012ull + i, 88765432ull + i);
+  s->buf = buf;
+  s->len = len;
+}
+
+static void
+make_diskstats(snapshot *s, int ndisks)
+{
+  size_t len = 0;
+  char *buf = NULL;
+  for (int i = 0; i < ndisks; i++)
+    buf = append(buf, &len, " 259 %7d nvme%dn1 %d 0 %d %d %d 0 %d %d 0 %d %d 0 0 0 0 0 0\n", i, i,
+                 183745 + i, 10932843 + i, 48211, 992833 + i, 88123412 + i, 2833411, 1441233 + i);
+  s->buf = buf;
+  s->len = len;
+}
+
+// What getstats.c did before the scanners, line by line off a FILE
+static void
+old_stat(snapshot *s)
+{
+  FILE *fp = fmemopen(s->buf, s->len, "r");
+  char buffer[512];
+  volatile unsigned long long sum = 0;
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    if (!strncmp(buffer, "cpu ", 4)) {
+      strtok(buffer, " ");
+      for (int f = 0; f < 4; f++) sum += atoll(strtok(NULL, " "));
+      break;
+    }
+  }
+  fclose(fp);
+}
+
+// The same, if it looked at every cpu as it has to for per core numbers
+static void
+old_stat_all(snapshot *s)
+{
+  FILE *fp = fmemopen(s->buf, s->len, "r");
+  char buffer[512];
+  volatile unsigned long long sum = 0;
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    if (!strncmp(buffer, "cpu", 3)) {
+      strtok(buffer, " ");
+      for (int f = 0; f < 8; f++) sum += atoll(strtok(NULL, " "));
+    }
+  }
+  fclose(fp);
+}
+
+static void
+old_meminfo(snapshot *s)
+{
+  FILE *fp = fmemopen(s->buf, s->len, "r");
+  char buffer[512], *tmp;
+  volatile unsigned long long v = 0;
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    if (!strncmp(buffer, "MemTotal:", 9) || !strncmp(buffer, "MemFree:", 8) ||
+        !strncmp(buffer, "Buffers:", 8) || !strncmp(buffer, "Cached:", 7) ||
+        !strncmp(buffer, "SwapTotal:", 10) || !strncmp(buffer, "SwapFree:", 9)) {
+      tmp = strchr(buffer, ':') + 1;
+      while (*tmp == ' ') tmp++;
+      v += atoll(tmp);
+    }
+  }
+  fclose(fp);
+}
+
+static void
+old_netdev(snapshot *s)
+{
+  FILE *fp = fmemopen(s->buf, s->len, "r");
+  char buffer[512], *ptr;
+  volatile unsigned long long rx = 0, tx = 0;
+
+  if (fgets(buffer, sizeof(buffer), fp) == NULL || fgets(buffer, sizeof(buffer), fp) == NULL) {
+    fclose(fp);
+    return;
+  }
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    strtok(buffer, ": ");
+    if ((ptr = strtok(NULL, ": ")) == NULL) break;
+    rx += atoll(ptr);
+    for (int f = 0; f < 8; f++) ptr = strtok(NULL, ": ");
+    tx += atoll(ptr);
+  }
+  fclose(fp);
+}
+
+static void
+old_loadavg(snapshot *s)
+{
+  FILE *fp = fmemopen(s->buf, s->len, "r");
+  char buffer[512];
+  char * volatile ptr;
+
+  if (fgets(buffer, sizeof(buffer), fp) != NULL) ptr = strtok(buffer, " ");
+  fclose(fp);
+}
+
+static void
+old_diskstats(snapshot *s)
+{
+  FILE *fp = fmemopen(s->buf, s->len, "r");
+  char buffer[512], *ptr;
+  volatile unsigned long long v = 0;
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    strtok(buffer, " ");
+    strtok(NULL, " ");
+    strtok(NULL, " ");
+    for (int f = 0; f < 10 && (ptr = strtok(NULL, " ")) != NULL; f++) v += atoll(ptr);
+  }
+  fclose(fp);
+}
+
+static statinfo st;
+static cputicks cpus[MAXCPU];
+static meminfo mi;
+static netif ifs[MAXDEV];
+static loadinfo li;
+static diskio disks[MAXDEV];
+
+static void new_stat(snapshot *s) { scan_stat_cpu(s->buf, s->len, &st.all); }
+static void new_stat_all(snapshot *s) { st.cpu = cpus; st.maxcpu = MAXCPU; scan_stat(s->buf, s->len, &st); }
+static void new_meminfo(snapshot *s) { scan_meminfo(s->buf, s->len, &mi); }
+static void new_netdev(snapshot *s) { scan_netdev(s->buf, s->len, ifs, MAXDEV); }
+static void new_loadavg(snapshot *s) { scan_loadavg(s->buf, s->len, &li); }
+static void new_diskstats(snapshot *s) { scan_diskstats(s->buf, s->len, disks, MAXDEV); }
+
+static double
+time_it(void (*parse)(snapshot*), snapshot *s)
+{
+  double start = now();
+  for (int r = 0; r < ROUNDS; r++) parse(s);
+  return((now() - start) / ROUNDS * 1e9);
+}
+
+static void
+run(const char *what, snapshot *s, void (*old)(snapshot*), void (*new)(snapshot*))
+{
+  if (s->buf == NULL) return;
+  double o = time_it(old, s), n = time_it(new, s);
+  printf("%-28s %8zu bytes %10.0f ns fgets+strtok %8.0f ns scan %6.1fx\n", what, s->len, o, n, o / n);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *files[] = { "stat", "meminfo", "net_dev", "loadavg", "diskstats" };
+  const char *live[] = { "/proc/stat", "/proc/meminfo", "/proc/net/dev", "/proc/loadavg", "/proc/diskstats" };
+  snapshot snap[5], big[3];
+  char path[4096];
+
+  for (int f = 0; f < 5; f++) {
+    if (argc > 1) {
+      snprintf(path, sizeof(path), "%s/%s", argv[1], files[f]);
+      snap[f].buf = slurp(path, &snap[f].len);
+    } else {
+      snap[f].buf = slurp(live[f], &snap[f].len);
+    }
+  }
+  printf("%s:\n", argc > 1 ? argv[1] : "this host");
+  run("stat, cpu line", &snap[0], old_stat, new_stat);
+  run("stat, every cpu", &snap[0], old_stat_all, new_stat_all);
+  run("meminfo", &snap[1], old_meminfo, new_meminfo);
+  run("net/dev", &snap[2], old_netdev, new_netdev);
+  run("loadavg", &snap[3], old_loadavg, new_loadavg);
+  run("diskstats", &snap[4], old_diskstats, new_diskstats);
+
+  if (argc > 1) return(0);
+  make_stat(&big[0], 256);
+  make_netdev(&big[1], 64);
+  make_diskstats(&big[2], 256);
+  printf("256 cores, 64 interfaces, 256 disks:\n");
+  run("stat, cpu line", &big[0], old_stat, new_stat);
+  run("stat, every cpu", &big[0], old_stat_all, new_stat_all);
+  run("net/dev", &big[1], old_netdev, new_netdev);
+  run("diskstats", &big[2], old_diskstats, new_diskstats);
+  return(0);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (bench_wire.c)
+ *
+ * Bytes per sample and ns to encode & decode one, for the full packet and
+ * the delta of an idle node, as JSON and in the binary encoding of wire.c.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "wire.h"
+#include "sample.h"
+
+#define SAMPLES 50000
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+run(const char *name, int delta)
+{
+  json_object **samples = malloc(SAMPLES * sizeof(json_object *));
+  char **json = malloc(SAMPLES * sizeof(char *));
+  wirebuf *bin = calloc(SAMPLES, sizeof(wirebuf));
+  wireconn *sender = wire_conn_new(NULL);
+  wireconn *receiver = wire_conn_new(NULL);
+  size_t json_bytes = 0, wire_bytes = 0;
+  double start, json_enc, json_dec, wire_enc, wire_dec;
+
+  // json-c keeps the string it made, so every sample is encoded once
+  for (int i = 0; i < SAMPLES; i++) {
+    time_t ts = 1300000000 + 2 * i;
+    samples[i] = delta ? sample_delta(ts, i) : sample_full("n00042", ts, i);
+  }
+  start = now();
+  for (int i = 0; i < SAMPLES; i++) json[i] = (char *) json_object_to_json_string(samples[i]);
+  json_enc = now() - start;
+
+  start = now();
+  for (int i = 0; i < SAMPLES; i++) wire_encode(&sender->out, samples[i], &bin[i]);
+  wire_enc = now() - start;
+
+  start = now();
+  for (int i = 0; i < SAMPLES; i++) {
+    json_object *jobj = json_tokener_parse(json[i]);
+    json_bytes += sizeof(apphdr) + strlen(json[i]);
+    json_object_put(jobj);
+  }
+  json_dec = now() - start;
+
+  start = now();
+  for (int i = 0; i < SAMPLES; i++) {
+    json_object *jobj = wire_decode(&receiver->in, bin[i].buf, bin[i].len);
+    if (jobj == NULL) {
+      fprintf(stderr, "Sample %d did not decode\n", i);
+      exit(1);
+    }
+    wire_bytes += sizeof(apphdr) + bin[i].len;
+    json_object_put(jobj);
+  }
+  wire_dec = now() - start;
+
+  printf("%-12s %10.0f %12.0f %12.0f\n", name, (double) json_bytes / SAMPLES,
+         json_enc * 1e9 / SAMPLES, json_dec * 1e9 / SAMPLES);
+  printf("%-12s %10.0f %12.0f %12.0f\n", "  binary", (double) wire_bytes / SAMPLES,
+         wire_enc * 1e9 / SAMPLES, wire_dec * 1e9 / SAMPLES);
+
+  for (int i = 0; i < SAMPLES; i++) {
+    json_object_put(samples[i]);
+    wire_buf_free(&bin[i]);
+  }
+  free(samples);
+  free(json);
+  free(bin);
+  wire_conn_free(sender);
+  wire_conn_free(receiver);
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("%-12s %10s %12s %12s\n", "", "bytes/pkt", "encode (ns)", "decode (ns)");
+  run("full, JSON", 0);
+  run("delta, JSON", 1);
+  return(0);
+}
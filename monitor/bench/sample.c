@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (sample.c)
+ *
+ * The samples the benchmarks feed the aggregator's code with, shaped like
+ * what wwmon_collector sends. seq makes every node, or every sample of
+ * one, a little different, as a real cluster is.
+ *
+ */
+
+#include "sample.h"
+
+// All the metrics of a node
+json_object *
+sample_full(const char *nodename, time_t timestamp, int seq)
+{
+  json_object *jobj = json_object_new_object();
+
+  json_object_object_add(jobj, "TIMESTAMP", json_object_new_int(timestamp));
+  json_object_object_add(jobj, "PROCS", json_object_new_int(180 + seq % 50));
+  json_object_object_add(jobj, "UPTIME", json_object_new_int(100000 + seq * 7));
+  json_object_object_add(jobj, "CPUCOUNT", json_object_new_int(16));
+  json_object_object_add(jobj, "CPUCLOCK", json_object_new_int(2600));
+  json_object_object_add(jobj, "CPUMODEL", json_object_new_string("Intel(R) Xeon(R) CPU E5-2670 0 @ 2.60GHz"));
+  json_object_object_add(jobj, "SYSNAME", json_object_new_string("Linux"));
+  json_object_object_add(jobj, "NODENAME", json_object_new_string(nodename));
+  json_object_object_add(jobj, "RELEASE", json_object_new_string("2.6.32-220.el6.x86_64"));
+  json_object_object_add(jobj, "VERSION", json_object_new_string("#1 SMP Wed Nov 9 08:03:13 EST 2011"));
+  json_object_object_add(jobj, "MACHINE", json_object_new_string("x86_64"));
+  json_object_object_add(jobj, "CPUUTIL", json_object_new_int(seq * 37 % 100));
+  json_object_object_add(jobj, "MEMTOTAL", json_object_new_int(64000));
+  json_object_object_add(jobj, "MEMAVAIL", json_object_new_int(20000 + seq * 131 % 40000));
+  json_object_object_add(jobj, "MEMUSED", json_object_new_int(44000 - seq * 131 % 40000));
+  json_object_object_add(jobj, "MEMPERCENT", json_object_new_int(seq * 13 % 100));
+  json_object_object_add(jobj, "SWAPTOTAL", json_object_new_int(4000));
+  json_object_object_add(jobj, "SWAPFREE", json_object_new_int(4000));
+  json_object_object_add(jobj, "SWAPUSED", json_object_new_int(0));
+  json_object_object_add(jobj, "SWAPPERCENT", json_object_new_int(0));
+  json_object_object_add(jobj, "LOADAVG", json_object_new_string(seq % 3 ? "0.01" : "15.92"));
+  json_object_object_add(jobj, "NETTRANSMIT", json_object_new_int(seq * 17 % 5000));
+  json_object_object_add(jobj, "NETRECEIVE", json_object_new_int(seq * 29 % 7000));
+  json_object_object_add(jobj, "NODESTATUS", json_object_new_string("ready"));
+  return(jobj);
+}
+
+// What an idle node sends once it reported in full: only what moved past its threshold
+json_object *
+sample_delta(time_t timestamp, int seq)
+{
+  json_object *jobj = json_object_new_object();
+
+  json_object_object_add(jobj, "DELTA", json_object_new_int(1));
+  json_object_object_add(jobj, "TIMESTAMP", json_object_new_int(timestamp));
+  json_object_object_add(jobj, "CPUUTIL", json_object_new_int(seq * 37 % 100));
+  return(jobj);
+}
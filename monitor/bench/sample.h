@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Warewulf Monitor (sample.h)
+ *
+ */
+
+#ifndef _SAMPLE_H
+#define _SAMPLE_H  1
+
+#include <time.h>
+#include <json/json.h>
+
+json_object *sample_full(const char *, time_t, int);
+json_object *sample_delta(time_t, int);
+
+#endif /* _SAMPLE_H */
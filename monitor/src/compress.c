@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (compress.c)
+ *
+ */
+
+// Compression of replies. A peer lists what it can decompress in the
+// "COMPRESS" of its CONN_TYPE registration, like "zstd,lz4,zlib", and the
+// reply names the first of them we were built with. Payloads of
+// COMPRESS_MINBYTES and up are then sent compressed, with the APPHDR_ flag
+// of the codec set in apphdr.len. Such a payload is the length of the
+// original (4 bytes, little endian) followed by
+//
+//   APPHDR_LZ4   an LZ4 block, the format of Perl's Compress::LZ4 as well
+//   APPHDR_ZSTD  a zstd frame
+//   APPHDR_ZLIB  a zlib stream, as made by compress2()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "config.h"
+#include "globals.h"
+#include "compress.h"
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define COMPRESS_LEVEL 1  // zstd & zlib, replies are made for every change
+
+static const struct {
+  const char *name;
+  int flag;
+} codecs[] = {
+#ifdef HAVE_ZSTD
+  { "zstd", APPHDR_ZSTD },
+#endif
+#ifdef HAVE_LZ4
+  { "lz4", APPHDR_LZ4 },
+#endif
+#ifdef HAVE_ZLIB
+  { "zlib", APPHDR_ZLIB },
+#endif
+  { NULL, 0 }
+};
+
+// The APPHDR_ flag of the first codec of list (',' separated names) we
+// have, 0 if none
+int
+compress_pick(const char *list)
+{
+  while (list != NULL && *list != '\0') {
+    size_t len = strcspn(list, ",");
+    for (int i = 0; codecs[i].name != NULL; i++) {
+      if (strlen(codecs[i].name) == len && strncasecmp(codecs[i].name, list, len) == 0)
+        return(codecs[i].flag);
+    }
+    list += len;
+    if (*list == ',') list++;
+  }
+  return(0);
+}
+
+const char *
+compress_name(int flag)
+{
+  for (int i = 0; codecs[i].name != NULL; i++) {
+    if (codecs[i].flag == (flag & APPHDR_COMPRESS)) return(codecs[i].name);
+  }
+  return(NULL);
+}
+
+// Compress len bytes of in with the codec of flag into *out (malloc()ed,
+// *outlen bytes). Returns the flag, or 0 if in is left as it is because it
+// is small, does not get any smaller or the codec failed.
+int
+compress_frame(int flag, const char *in, size_t len, char **out, size_t *outlen)
+{
+  size_t bound = 0, n = 0;
+  char *buf;
+
+  flag &= APPHDR_COMPRESS;
+  if (flag == 0 || len < COMPRESS_MINBYTES || len > MAXFRAMELEN) return(0);
+
+  switch (flag) {
+#ifdef HAVE_LZ4
+  case APPHDR_LZ4:
+    bound = LZ4_compressBound(len);
+    break;
+#endif
+#ifdef HAVE_ZSTD
+  case APPHDR_ZSTD:
+    bound = ZSTD_compressBound(len);
+    break;
+#endif
+#ifdef HAVE_ZLIB
+  case APPHDR_ZLIB:
+    bound = compressBound(len);
+    break;
+#endif
+  default:
+    return(0);
+  }
+  if ((buf = malloc(4 + bound)) == NULL) {
+    perror("malloc");
+    return(0);
+  }
+  for (int i = 0; i < 4; i++) buf[i] = (len >> (8 * i)) & 0xff;
+
+  switch (flag) {
+#ifdef HAVE_LZ4
+  case APPHDR_LZ4: {
+    int rc = LZ4_compress_default(in, buf + 4, len, bound);
+    n = (rc > 0) ? rc : 0;
+    break;
+  }
+#endif
+#ifdef HAVE_ZSTD
+  case APPHDR_ZSTD: {
+    size_t rc = ZSTD_compress(buf + 4, bound, in, len, COMPRESS_LEVEL);
+    n = ZSTD_isError(rc) ? 0 : rc;
+    break;
+  }
+#endif
+#ifdef HAVE_ZLIB
+  case APPHDR_ZLIB: {
+    uLongf zlen = bound;
+    n = (compress2((Bytef *) buf + 4, &zlen, (const Bytef *) in, len, COMPRESS_LEVEL) == Z_OK) ? zlen : 0;
+    break;
+  }
+#endif
+  }
+
+  if (n == 0 || 4 + n >= len) {
+    free(buf);
+    return(0);
+  }
+  *out = buf;
+  *outlen = 4 + n;
+  return(flag);
+}
+
+// The original of a payload compressed with the codec of flag, NUL
+// terminated, its length in *outlen. NULL if it is damaged.
+char *
+decompress_frame(int flag, const char *in, size_t len, size_t *outlen)
+{
+  size_t orig = 0, n = 0;
+  char *buf;
+
+  if (len < 4) return(NULL);
+  for (int i = 0; i < 4; i++) orig |= (size_t) (unsigned char) in[i] << (8 * i);
+  if (orig > MAXFRAMELEN || (buf = malloc(orig + 1)) == NULL) return(NULL);
+
+  switch (flag & APPHDR_COMPRESS) {
+#ifdef HAVE_LZ4
+  case APPHDR_LZ4: {
+    int rc = LZ4_decompress_safe(in + 4, buf, len - 4, orig);
+    n = (rc >= 0) ? rc : orig + 1;
+    break;
+  }
+#endif
+#ifdef HAVE_ZSTD
+  case APPHDR_ZSTD: {
+    size_t rc = ZSTD_decompress(buf, orig, in + 4, len - 4);
+    n = ZSTD_isError(rc) ? orig + 1 : rc;
+    break;
+  }
+#endif
+#ifdef HAVE_ZLIB
+  case APPHDR_ZLIB: {
+    uLongf zlen = orig;
+    n = (uncompress((Bytef *) buf, &zlen, (const Bytef *) in + 4, len - 4) == Z_OK) ? zlen : orig + 1;
+    break;
+  }
+#endif
+  default:
+    n = orig + 1;
+  }
+
+  if (n != orig) {
+    free(buf);
+    return(NULL);
+  }
+  buf[orig] = '\0';
+  *outlen = orig;
+  return(buf);
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (compress.h)
+ *
+ */
+
+#ifndef _COMPRESS_H
+#define _COMPRESS_H  1
+
+#include <stddef.h>
+
+#include "globals.h"
+
+int compress_pick(const char*);
+const char *compress_name(int);
+int compress_frame(int, const char*, size_t, char**, size_t*);
+char *decompress_frame(int, const char*, size_t, size_t*);
+
+#endif /* _COMPRESS_H */
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (dbstore.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json/json.h>
+#include <sqlite3.h>
+
+#include "globals.h"
+#include "dbstore.h"
+
+static int
+prepare(dbstore *ds, sqlite3_stmt **stmt, char *fmt, char *tname)
+{
+  char sqlcmd[MAX_SQL_SIZE];
+
+  snprintf(sqlcmd, MAX_SQL_SIZE, fmt, tname);
+  if (sqlite3_prepare_v2(ds->db, sqlcmd, -1, stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "SQL error: %s (%s)\n", sqlite3_errmsg(ds->db), sqlcmd);
+    return(-1);
+  }
+  return(0);
+}
+
+// Run a statement that was just bound and make it ready for the next use
+static int
+step(dbstore *ds, sqlite3_stmt *stmt)
+{
+  int rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(ds->db));
+  }
+  sqlite3_reset(stmt);
+  return(rc);
+}
+
+static void
+bind_value(sqlite3_stmt *stmt, int idx, json_object *val)
+{
+  switch (json_object_get_type(val)) {
+  case json_type_int:
+    sqlite3_bind_int(stmt, idx, json_object_get_int(val));
+    break;
+  case json_type_double:
+    sqlite3_bind_double(stmt, idx, json_object_get_double(val));
+    break;
+  default:
+    sqlite3_bind_text(stmt, idx, json_object_get_string(val), -1, SQLITE_STATIC);
+    break;
+  }
+}
+
+// Write every key of jobj to lookups with the given insert statement
+static void
+write_lookups(dbstore *ds, sqlite3_stmt *stmt, sqlite3_int64 blobid, json_object *jobj)
+{
+  json_object_object_foreach(jobj, key, value) {
+    sqlite3_bind_int64(stmt, 1, blobid);
+    sqlite3_bind_text(stmt, 2, key, -1, SQLITE_STATIC);
+    bind_value(stmt, 3, value);
+    step(ds, stmt);
+  }
+}
+
+// Add the keys of from that into does not have yet
+static void
+merge_missing(json_object *into, json_object *from)
+{
+  json_object_object_foreach(from, key, value) {
+    if (json_object_object_get(into, key) == NULL) {
+      json_object_object_add(into, key, json_object_get(value));
+    }
+  }
+}
+
+// Open a transaction unless one already is, and count the packet in it
+static int
+begin(dbstore *ds)
+{
+  char *emsg = 0;
+
+  if (!ds->in_txn) {
+    if (sqlite3_exec(ds->db, "begin", NULL, NULL, &emsg) != SQLITE_OK) {
+      fprintf(stderr, "SQL error: %s\n", emsg);
+      sqlite3_free(emsg);
+      return(-1);
+    }
+    ds->in_txn = 1;
+    ds->txn_start = time(NULL);
+    ds->txn_pkts = 0;
+  }
+  ds->txn_pkts++;
+  return(0);
+}
+
+int
+dbstore_open(dbstore *ds, sqlite3 *db)
+{
+  char *emsg = 0;
+
+  bzero(ds, sizeof(dbstore));
+  ds->db = db;
+
+  if (prepare(ds, &ds->get_node, "select rowid, timestamp, jsonblob from %s where nodename=?", SQLITE_DB_TB1NAME) ||
+      prepare(ds, &ds->insert_node, "insert into %s(nodename, timestamp, jsonblob) values(?,?,?)", SQLITE_DB_TB1NAME) ||
+      prepare(ds, &ds->update_node, "update %s set timestamp=?, jsonblob=? where rowid=?", SQLITE_DB_TB1NAME) ||
+      prepare(ds, &ds->put_lookup, "insert or replace into %s(blobid, key, value) values(?,?,?)", SQLITE_DB_TB2NAME) ||
+      prepare(ds, &ds->add_lookup, "insert or ignore into %s(blobid, key, value) values(?,?,?)", SQLITE_DB_TB2NAME)) {
+    dbstore_close(ds);
+    return(-1);
+  }
+
+  // Older aggregators stored the blobid as text, which would not match
+  // the integer we bind in the primary key.
+  if (sqlite3_exec(db, "update " SQLITE_DB_TB2NAME " set blobid=cast(blobid as integer) where typeof(blobid)='text'",
+                   NULL, NULL, &emsg) != SQLITE_OK) {
+    fprintf(stderr, "SQL error: %s\n", emsg);
+    sqlite3_free(emsg);
+  }
+
+  return(0);
+}
+
+void
+dbstore_close(dbstore *ds)
+{
+  dbstore_commit(ds);
+  sqlite3_finalize(ds->get_node);
+  sqlite3_finalize(ds->insert_node);
+  sqlite3_finalize(ds->update_node);
+  sqlite3_finalize(ds->put_lookup);
+  sqlite3_finalize(ds->add_lookup);
+  bzero(ds, sizeof(dbstore));
+}
+
+// Merge a packet from a node into what we have of it. Keys of a newer
+// packet replace ours, an older packet only fills in keys we lack.
+int
+dbstore_update(dbstore *ds, char *nodename, time_t timestamp, json_object *jobj)
+{
+  sqlite3_int64 blobid = -1;
+  time_t dbts = -1;
+  json_object *oldjobj = NULL;
+  const char *blob;
+
+  if (begin(ds) < 0) return(-1);
+
+  sqlite3_bind_text(ds->get_node, 1, nodename, -1, SQLITE_STATIC);
+  if (sqlite3_step(ds->get_node) == SQLITE_ROW) {
+    blobid = sqlite3_column_int64(ds->get_node, 0);
+    dbts = sqlite3_column_int64(ds->get_node, 1);
+    if ((blob = (const char *) sqlite3_column_text(ds->get_node, 2)) != NULL) {
+      oldjobj = json_tokener_parse(blob);
+    }
+  }
+  sqlite3_reset(ds->get_node);
+
+  if (blobid < 0) { // PKT with data from a new node
+
+    sqlite3_bind_text(ds->insert_node, 1, nodename, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(ds->insert_node, 2, timestamp);
+    sqlite3_bind_text(ds->insert_node, 3, json_object_to_json_string(jobj), -1, SQLITE_STATIC);
+    step(ds, ds->insert_node);
+    blobid = sqlite3_last_insert_rowid(ds->db);
+    write_lookups(ds, ds->put_lookup, blobid, jobj);
+
+  } else if (dbts < timestamp || oldjobj == NULL) { // PKT with newer time stamp
+
+    write_lookups(ds, ds->put_lookup, blobid, jobj);
+    if (oldjobj != NULL) merge_missing(jobj, oldjobj);
+    sqlite3_bind_int64(ds->update_node, 1, timestamp);
+    sqlite3_bind_text(ds->update_node, 2, json_object_to_json_string(jobj), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(ds->update_node, 3, blobid);
+    step(ds, ds->update_node);
+
+  } else { // PKT with same time stamp or with older time stamp
+
+    write_lookups(ds, ds->add_lookup, blobid, jobj);
+    merge_missing(oldjobj, jobj);
+    sqlite3_bind_int64(ds->update_node, 1, dbts);
+    sqlite3_bind_text(ds->update_node, 2, json_object_to_json_string(oldjobj), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(ds->update_node, 3, blobid);
+    step(ds, ds->update_node);
+
+  }
+
+  if (oldjobj != NULL) json_object_put(oldjobj);
+  return(0);
+}
+
+// Store the complete, already merged state of a node as is
+int
+dbstore_put(dbstore *ds, char *nodename, time_t timestamp, const char *blob)
+{
+  sqlite3_int64 blobid = -1;
+  json_object *jobj;
+
+  if ((jobj = json_tokener_parse(blob)) == NULL) return(-1);
+  if (begin(ds) < 0) {
+    json_object_put(jobj);
+    return(-1);
+  }
+
+  sqlite3_bind_text(ds->get_node, 1, nodename, -1, SQLITE_STATIC);
+  if (sqlite3_step(ds->get_node) == SQLITE_ROW) {
+    blobid = sqlite3_column_int64(ds->get_node, 0);
+  }
+  sqlite3_reset(ds->get_node);
+
+  if (blobid < 0) {
+    sqlite3_bind_text(ds->insert_node, 1, nodename, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(ds->insert_node, 2, timestamp);
+    sqlite3_bind_text(ds->insert_node, 3, blob, -1, SQLITE_STATIC);
+    step(ds, ds->insert_node);
+    blobid = sqlite3_last_insert_rowid(ds->db);
+  } else {
+    sqlite3_bind_int64(ds->update_node, 1, timestamp);
+    sqlite3_bind_text(ds->update_node, 2, blob, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(ds->update_node, 3, blobid);
+    step(ds, ds->update_node);
+  }
+  write_lookups(ds, ds->put_lookup, blobid, jobj);
+
+  json_object_put(jobj);
+  return(0);
+}
+
+int
+dbstore_commit(dbstore *ds)
+{
+  char *emsg = 0;
+
+  if (!ds->in_txn) return(0);
+  ds->in_txn = 0;
+  if (sqlite3_exec(ds->db, "commit", NULL, NULL, &emsg) != SQLITE_OK) {
+    fprintf(stderr, "SQL error: %s\n", emsg);
+    sqlite3_free(emsg);
+    return(-1);
+  }
+  return(0);
+}
+
+// Commit once the open transaction is a tick old
+int
+dbstore_tick(dbstore *ds, time_t now)
+{
+  if (ds->in_txn && now - ds->txn_start >= DBSTORE_TICK) {
+    return(dbstore_commit(ds));
+  }
+  return(0);
+}
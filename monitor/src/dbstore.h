@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (dbstore.h)
+ *
+ */
+
+#ifndef _DBSTORE_H
+#define _DBSTORE_H  1
+
+#include <time.h>
+#include <json/json.h>
+#include <sqlite3.h>
+
+#include "globals.h"
+
+// Write path into the datastore & lookups tables. Statements are
+// prepared once and reused, and writes are grouped into one transaction
+// per DBSTORE_TICK seconds.
+typedef struct database_store {
+
+	sqlite3 *db;
+
+	sqlite3_stmt *get_node;     // rowid, timestamp & jsonblob of a node
+	sqlite3_stmt *insert_node;
+	sqlite3_stmt *update_node;
+	sqlite3_stmt *put_lookup;   // insert or replace a key
+	sqlite3_stmt *add_lookup;   // insert a key unless it exists
+
+	int     in_txn;     // A transaction is open
+	time_t  txn_start;  // and when it was opened
+	int     txn_pkts;   // # of packets written in it
+
+} dbstore;
+
+int dbstore_open(dbstore*, sqlite3*);
+void dbstore_close(dbstore*);
+int dbstore_update(dbstore*, char*, time_t, json_object*);
+int dbstore_put(dbstore*, char*, time_t, const char*);
+int dbstore_commit(dbstore*);
+int dbstore_tick(dbstore*, time_t);
+
+#endif /* _DBSTORE_H */
@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (filter.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "filter.h"
+
+// Tokens of the expression
+#define TOK_END 0
+#define TOK_WORD 1
+#define TOK_CMP 2
+#define TOK_AND 3
+#define TOK_OR 4
+#define TOK_NOT 5
+#define TOK_LP 6
+#define TOK_RP 7
+#define TOK_ERR 8
+
+typedef struct filter_parser {
+
+	const char *p;    // next character to scan
+	int     tok;      // current token
+	int     cmp;      // its comparison, for TOK_CMP
+	char    word[MAX_SQL_SIZE];  // its text, for TOK_WORD
+	filter  *f;
+	char    *err;
+	int     errlen;
+
+} parser;
+
+static int expr(parser *ps);
+
+// Is s a number as a whole, and which
+static int
+to_number(const char *s, double *num)
+{
+  char *end;
+
+  if (*s == '\0') return(0);
+  *num = strtod(s, &end);
+  return(*end == '\0');
+}
+
+static void
+next(parser *ps)
+{
+  const char *p = ps->p;
+  int n = 0;
+
+  while (isspace((unsigned char) *p)) p++;
+
+  if (*p == '\0') {
+    ps->tok = TOK_END;
+  } else if (*p == '(' || *p == ')') {
+    ps->tok = (*p++ == '(') ? TOK_LP : TOK_RP;
+  } else if (strncmp(p, "&&", 2) == 0 || strncmp(p, "||", 2) == 0) {
+    ps->tok = (*p == '&') ? TOK_AND : TOK_OR;
+    p += 2;
+  } else if (strncmp(p, "!=", 2) == 0 || strncmp(p, "<>", 2) == 0) {
+    ps->tok = TOK_CMP; ps->cmp = CMP_NE; p += 2;
+  } else if (strncmp(p, "<=", 2) == 0) {
+    ps->tok = TOK_CMP; ps->cmp = CMP_LE; p += 2;
+  } else if (strncmp(p, ">=", 2) == 0) {
+    ps->tok = TOK_CMP; ps->cmp = CMP_GE; p += 2;
+  } else if (strncmp(p, "==", 2) == 0) {
+    ps->tok = TOK_CMP; ps->cmp = CMP_EQ; p += 2;
+  } else if (*p == '=' || *p == '<' || *p == '>' || *p == '~') {
+    ps->tok = TOK_CMP;
+    ps->cmp = (*p == '=') ? CMP_EQ : (*p == '<') ? CMP_LT : (*p == '>') ? CMP_GT : CMP_GLOB;
+    p++;
+  } else if (*p == '!') {
+    ps->tok = TOK_NOT;
+    p++;
+  } else if (*p == '\'' || *p == '"') {
+    char quote = *p++;
+    while (*p != quote && *p != '\0' && n < sizeof(ps->word) - 1) ps->word[n++] = *p++;
+    if (*p != quote) {
+      snprintf(ps->err, ps->errlen, "unterminated string");
+      ps->tok = TOK_ERR;
+      return;
+    }
+    p++;
+    ps->word[n] = '\0';
+    ps->tok = TOK_WORD;
+  } else {
+    while (*p != '\0' && !isspace((unsigned char) *p) && strchr("()=!<>~&|'\"", *p) == NULL &&
+           n < sizeof(ps->word) - 1) {
+      ps->word[n++] = *p++;
+    }
+    ps->word[n] = '\0';
+    if (n == 0) {
+      snprintf(ps->err, ps->errlen, "unexpected '%c'", *p);
+      ps->tok = TOK_ERR;
+      return;
+    }
+    if (strcasecmp(ps->word, "and") == 0) ps->tok = TOK_AND;
+    else if (strcasecmp(ps->word, "or") == 0) ps->tok = TOK_OR;
+    else if (strcasecmp(ps->word, "not") == 0) ps->tok = TOK_NOT;
+    else if (strcasecmp(ps->word, "like") == 0) { ps->tok = TOK_CMP; ps->cmp = CMP_GLOB; }
+    else ps->tok = TOK_WORD;
+  }
+  ps->p = p;
+}
+
+static filterop *
+emit(parser *ps, int op)
+{
+  if (ps->f->nops == FILTER_MAXOPS) {
+    snprintf(ps->err, ps->errlen, "more than %d terms", FILTER_MAXOPS);
+    return(NULL);
+  }
+  filterop *o = &ps->f->ops[ps->f->nops++];
+  o->op = op;
+  return(o);
+}
+
+// key op value, a (parenthesized expression) or not of either
+static int
+factor(parser *ps)
+{
+  filterop *o;
+  char *key;
+
+  if (ps->tok == TOK_NOT) {
+    next(ps);
+    if (factor(ps) < 0) return(-1);
+    return(emit(ps, FOP_NOT) ? 0 : -1);
+  }
+  if (ps->tok == TOK_LP) {
+    next(ps);
+    if (expr(ps) < 0) return(-1);
+    if (ps->tok != TOK_RP) {
+      snprintf(ps->err, ps->errlen, "missing ')'");
+      return(-1);
+    }
+    next(ps);
+    return(0);
+  }
+  if (ps->tok != TOK_WORD) {
+    snprintf(ps->err, ps->errlen, "expected a key");
+    return(-1);
+  }
+  key = strdup(ps->word);
+  next(ps);
+  if (ps->tok != TOK_CMP) {
+    snprintf(ps->err, ps->errlen, "expected a comparison after %s", key);
+    free(key);
+    return(-1);
+  }
+  int cmp = ps->cmp;
+  next(ps);
+  if (ps->tok != TOK_WORD) {
+    snprintf(ps->err, ps->errlen, "expected a value to compare %s with", key);
+    free(key);
+    return(-1);
+  }
+  if ((o = emit(ps, FOP_COND)) == NULL) {
+    free(key);
+    return(-1);
+  }
+  o->cmp = cmp;
+  o->key = key;
+  o->str = strdup(ps->word);
+  o->isnum = (cmp != CMP_GLOB) && to_number(o->str, &o->num);
+  next(ps);
+  return(0);
+}
+
+static int
+term(parser *ps)
+{
+  if (factor(ps) < 0) return(-1);
+  while (ps->tok == TOK_AND) {
+    next(ps);
+    if (factor(ps) < 0 || emit(ps, FOP_AND) == NULL) return(-1);
+  }
+  return(0);
+}
+
+static int
+expr(parser *ps)
+{
+  if (term(ps) < 0) return(-1);
+  while (ps->tok == TOK_OR) {
+    next(ps);
+    if (term(ps) < 0 || emit(ps, FOP_OR) == NULL) return(-1);
+  }
+  return(0);
+}
+
+// Parse glob into g, see nameglob. -1 with a message in err if it has a
+// range that is no good.
+static int
+parse_glob(const char *glob, nameglob *g, char *err, int errlen)
+{
+  const char *open = strrchr(glob, '['), *close = NULL, *p;
+
+  // Like expand_bracket, the last [] and only if it is all digits, '-' and ','
+  if (open != NULL) close = strchr(open, ']');
+  if (close != NULL && close > open + 1 && strspn(open + 1, "0123456789-,") == close - open - 1) {
+    g->prefix = strndup(glob, open - glob);
+    g->suffix = strdup(close + 1);
+    for (p = open + 1; p < close; ) {
+      const char *comma = memchr(p, ',', close - p), *end = comma ? comma : close;
+      char *dash;
+      if (end == p) {
+        p = end + 1;
+        continue;
+      }
+      if (g->nranges == FILTER_MAXRANGES) {
+        snprintf(err, errlen, "more than %d ranges in '%s'", FILTER_MAXRANGES, glob);
+        return(-1);
+      }
+      g->ranges[g->nranges].lo = strtoul(p, &dash, 10);
+      if (dash == p || (dash < end && (*dash != '-' || dash + 1 == end || memchr(dash + 1, '-', end - dash - 1)))) {
+        snprintf(err, errlen, "bad range '%.*s' in '%s'", (int) (end - p), p, glob);
+        return(-1);
+      }
+      g->ranges[g->nranges].hi = (dash < end) ? strtoul(dash + 1, NULL, 10) : g->ranges[g->nranges].lo;
+      g->ranges[g->nranges].width = (dash < end) ? end - dash - 1 : end - p;
+      if (g->ranges[g->nranges].hi < g->ranges[g->nranges].lo) {
+        // Counting down, the same as counting up
+        unsigned long lo = g->ranges[g->nranges].hi;
+        g->ranges[g->nranges].hi = g->ranges[g->nranges].lo;
+        g->ranges[g->nranges].lo = lo;
+        g->ranges[g->nranges].width = (dash < end) ? dash - p : end - p;
+      }
+      g->nranges++;
+      p = end + 1;
+    }
+  } else {
+    g->prefix = strdup(glob);
+  }
+  return(0);
+}
+
+// Does name match g: the prefix glob, then width digits in one of the
+// ranges, then the suffix glob
+static int
+match_glob(nameglob *g, const char *name)
+{
+  size_t len = strlen(name);
+  char head[MAX_NODENAME_LEN];
+
+  if (g->suffix == NULL) return(fnmatch(g->prefix, name, 0) == 0);
+  for (int r = 0; r < g->nranges; r++) {
+    int w = g->ranges[r].width;
+    for (size_t at = 0; at + w <= len && at < sizeof(head); at++) {
+      unsigned long n = 0;
+      int i;
+      for (i = 0; i < w && name[at + i] >= '0' && name[at + i] <= '9'; i++) n = n * 10 + (name[at + i] - '0');
+      if (i < w || n < g->ranges[r].lo || n > g->ranges[r].hi) continue;
+      memcpy(head, name, at);
+      head[at] = '\0';
+      if (fnmatch(g->prefix, head, 0) == 0 && fnmatch(g->suffix, name + at + w, 0) == 0) return(1);
+    }
+  }
+  return(0);
+}
+
+// Compile the expression and the ',' separated node name globs, either
+// may be NULL or empty. Returns NULL with a message in err if they don't
+// make sense.
+filter *
+filter_compile(const char *expression, const char *globs, char *err, int errlen)
+{
+  filter *f = calloc(1, sizeof(filter));
+  parser ps;
+
+  err[0] = '\0';
+  if (f == NULL) {
+    snprintf(err, errlen, "out of memory");
+    return(NULL);
+  }
+
+  if (expression != NULL) {
+    bzero(&ps, sizeof(ps));
+    ps.p = expression;
+    ps.f = f;
+    ps.err = err;
+    ps.errlen = errlen;
+    next(&ps);
+    if (ps.tok != TOK_END && (ps.tok == TOK_ERR || expr(&ps) < 0 || ps.tok != TOK_END)) {
+      if (ps.tok != TOK_END && ps.tok != TOK_ERR && err[0] == '\0') {
+        snprintf(err, errlen, "unexpected text before '%s'", ps.p);
+      }
+      filter_free(f);
+      return(NULL);
+    }
+  }
+
+  // Split at ',' and blanks, but not at the ',' of a range
+  for (const char *p = globs; p != NULL && *p != '\0'; ) {
+    const char *end = p;
+    char glob[MAX_NODENAME_LEN * 4];
+    int depth = 0;
+
+    for (; *end != '\0' && (depth > 0 || (*end != ',' && *end != ' ')); end++) {
+      if (*end == '[') depth++;
+      else if (*end == ']' && depth > 0) depth--;
+    }
+    if (end > p) {
+      if (f->nglobs == FILTER_MAXGLOBS) {
+        snprintf(err, errlen, "more than %d node names", FILTER_MAXGLOBS);
+        filter_free(f);
+        return(NULL);
+      }
+      if (end - p >= sizeof(glob)) {
+        snprintf(err, errlen, "node name '%.*s...' is too long", MAX_NODENAME_LEN, p);
+        filter_free(f);
+        return(NULL);
+      }
+      memcpy(glob, p, end - p);
+      glob[end - p] = '\0';
+      if (parse_glob(glob, &f->globs[f->nglobs++], err, errlen) < 0) {
+        filter_free(f);
+        return(NULL);
+      }
+    }
+    p = (*end != '\0') ? end + 1 : end;
+  }
+  return(f);
+}
+
+// Compare what a node has for the key of a condition. Only read only
+// accessors of jobj are used, other queries may be looking at it too.
+static int
+test(filterop *o, json_object *jobj)
+{
+  json_object *val = json_object_object_get(jobj, o->key);
+  char buf[64];
+  const char *s;
+  double num;
+  int c;
+
+  if (val == NULL) return(0);
+
+  switch (json_object_get_type(val)) {
+  case json_type_int:
+    num = json_object_get_int(val);
+    snprintf(buf, sizeof(buf), "%d", json_object_get_int(val));
+    s = buf;
+    break;
+  case json_type_double:
+    num = json_object_get_double(val);
+    snprintf(buf, sizeof(buf), "%g", num);
+    s = buf;
+    break;
+  case json_type_string:
+    s = json_object_get_string(val);
+    // Numbers sent as strings (LOADAVG) still compare as numbers
+    if (o->isnum && to_number(s, &num)) break;
+    goto string;
+  default:
+    return(0);
+  }
+
+  if (o->isnum) {
+    switch (o->cmp) {
+    case CMP_EQ: return(num == o->num);
+    case CMP_NE: return(num != o->num);
+    case CMP_LT: return(num < o->num);
+    case CMP_LE: return(num <= o->num);
+    case CMP_GT: return(num > o->num);
+    case CMP_GE: return(num >= o->num);
+    }
+  }
+
+string:
+  if (o->cmp == CMP_GLOB) return(fnmatch(o->str, s, 0) == 0);
+  c = strcmp(s, o->str);
+  switch (o->cmp) {
+  case CMP_EQ: return(c == 0);
+  case CMP_NE: return(c != 0);
+  case CMP_LT: return(c < 0);
+  case CMP_LE: return(c <= 0);
+  case CMP_GT: return(c > 0);
+  case CMP_GE: return(c >= 0);
+  }
+  return(0);
+}
+
+// Does the node pass the filter
+int
+filter_match(filter *f, const char *nodename, json_object *jobj)
+{
+  char stack[FILTER_MAXOPS];
+  int sp = 0;
+
+  if (f->nglobs > 0) {
+    int i;
+    for (i = 0; i < f->nglobs && !match_glob(&f->globs[i], nodename); i++);
+    if (i == f->nglobs) return(0);
+  }
+
+  for (int i = 0; i < f->nops; i++) {
+    filterop *o = &f->ops[i];
+    switch (o->op) {
+    case FOP_COND:
+      stack[sp++] = test(o, jobj);
+      break;
+    case FOP_AND:
+      sp--;
+      stack[sp-1] = stack[sp-1] && stack[sp];
+      break;
+    case FOP_OR:
+      sp--;
+      stack[sp-1] = stack[sp-1] || stack[sp];
+      break;
+    case FOP_NOT:
+      stack[sp-1] = !stack[sp-1];
+      break;
+    }
+  }
+  return(sp == 0 || stack[0]);
+}
+
+void
+filter_free(filter *f)
+{
+  if (f == NULL) return;
+  for (int i = 0; i < f->nops; i++) {
+    free(f->ops[i].key);
+    free(f->ops[i].str);
+  }
+  for (int i = 0; i < f->nglobs; i++) {
+    free(f->globs[i].prefix);
+    free(f->globs[i].suffix);
+  }
+  free(f);
+}
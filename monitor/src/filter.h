@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (filter.h)
+ *
+ */
+
+#ifndef _FILTER_H
+#define _FILTER_H  1
+
+#include <json/json.h>
+
+#include "globals.h"
+
+#define FILTER_MAXOPS 256   // Conditions plus and/or/not in one filter
+#define FILTER_MAXGLOBS 64  // Node name globs in one filter
+#define FILTER_MAXRANGES 32 // Numbers or ranges in the [] of one of them
+
+// Instructions of a compiled filter
+#define FOP_COND 0   // push the result of one key op value test
+#define FOP_AND 1    // pop two, push both true
+#define FOP_OR 2     // pop two, push either true
+#define FOP_NOT 3    // pop one, push the opposite
+
+// Comparisons of a condition
+#define CMP_EQ 0
+#define CMP_NE 1
+#define CMP_LT 2
+#define CMP_LE 3
+#define CMP_GT 4
+#define CMP_GE 5
+#define CMP_GLOB 6   // shell glob, as fnmatch() does it
+
+typedef struct filter_op {
+
+	int     op;
+	int     cmp;
+	char    *key;
+	char    *str;     // value to compare with
+	double  num;      // and as a number,
+	int     isnum;    // if it is one
+
+} filterop;
+
+// A node name glob. One with a [] of numbers and ranges, like n00[00-19,25],
+// means what it does to wwsh (Warewulf::Util::expand_bracket): the names
+// with one of those numbers there, as many digits as the last of its range
+// has. The globs before and after it are kept apart.
+typedef struct name_glob {
+
+	char    *prefix;  // the whole glob if it has no range
+	char    *suffix;  // NULL if it has no range
+	int     nranges;
+	struct {
+		unsigned long lo;
+		unsigned long hi;
+		int     width;
+	} ranges[FILTER_MAXRANGES];
+
+} nameglob;
+
+// An expression like  CPUUTIL > 50 and (NODESTATUS = ready or not LOADAVG < 1)
+// compiled to postfix, plus the node names it is limited to
+typedef struct node_filter {
+
+	filterop ops[FILTER_MAXOPS];
+	int     nops;     // 0 matches every node
+	nameglob globs[FILTER_MAXGLOBS];
+	int     nglobs;   // 0 matches every node name
+
+} filter;
+
+filter *filter_compile(const char*, const char*, char*, int);
+int filter_match(filter*, const char*, json_object*);
+void filter_free(filter*);
+
+#endif /* _FILTER_H */
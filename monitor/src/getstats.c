@@ -19,8 +19,12 @@
 #include <sys/sysinfo.h>
 #include <sys/utsname.h>
 #include <ctype.h>
+#include <strings.h>
 
 #include "getstats.h"
+#include "procfile.h"
+#include "procscan.h"
+#include "rate.h"
 
 // The Generic Buffersize to use
 #define BUFFERSIZE 511
@@ -28,24 +32,70 @@
 // Where is the status file to determine the node status
 #define STATUSFILE "/.nodestatus"
 
-// Sleep time inbetween loops
-#define REFRESH 1
+// Interfaces of /proc/net/dev looked at
+#define GETSTATS_MAXIFS 64
+
+// Cpus of /proc/stat looked at one by one
+#define GETSTATS_MAXCPU 512
+
+// Opened once and re-read every loop
+static procfile loadavg_f = PROCFILE_INIT("/proc/loadavg");
+static procfile stat_f = PROCFILE_INIT("/proc/stat");
+static procfile meminfo_f = PROCFILE_INIT("/proc/meminfo");
+static procfile netdev_f = PROCFILE_INIT("/proc/net/dev");
+static procfile status_f = PROCFILE_INIT(STATUSFILE);
+
+// Counters the rates are of, since the last sample whenever that was
+static ratetable rates = RATE_TABLE_INIT;
+
+// The next line of what *p points into, cut off at its end. NULL past
+// the last one.
+static char *
+nextline(char **p)
+{
+	char *line = *p, *nl;
+
+	if (*line == '\0') return(NULL);
+	if ((nl = strchr(line, '\n')) != NULL) {
+		*nl = '\0';
+		*p = nl + 1;
+	} else {
+		*p = line + strlen(line);
+	}
+	return(line);
+}
 
+// Like open() failing used to, there is nothing to report without them
+static char *
+must_read(procfile *pf)
+{
+	if (procfile_read(pf) < 0) {
+		printf("could not read %s!\n", pf->path);
+		exit(EXIT_FAILURE);
+	}
+	return(pf->buf);
+}
+
+// These don't change while we run, /proc/cpuinfo is read the first time only
 char * get_cpu_info(json_object *jobj) {
-	FILE *fd;
-	unsigned int cpu_count = 0;
-	unsigned int cpu_clock = 0;
+	static unsigned int cpu_count = 0;
+	static unsigned int cpu_clock = 0;
+	static char cpu_model[BUFFERSIZE+1];
+	static int done = 0;
 	char *tmp ;
-	char buffer[BUFFERSIZE+1];
-	char cpu_model[BUFFERSIZE+1];
+	char *buffer, *p;
 	static char ret[BUFFERSIZE+1];
 
-	if (( fd = fopen("/proc/cpuinfo", "r")) == NULL ) {
-		printf("could not open /proc/cpuinfo!\n");
-		exit(EXIT_FAILURE);
+	if (done) {
+		json_object_object_add(jobj,"CPUCOUNT",json_object_new_int(cpu_count));
+		json_object_object_add(jobj,"CPUCLOCK",json_object_new_int(cpu_clock));
+		json_object_object_add(jobj,"CPUMODEL",json_object_new_string(cpu_model));
+		return(ret);
 	}
-	while(!feof(fd)) {
-		fgets(buffer, BUFFERSIZE, fd);
+
+	procfile cpuinfo_f = PROCFILE_INIT("/proc/cpuinfo");
+	p = must_read(&cpuinfo_f);
+	while((buffer = nextline(&p)) != NULL) {
 		if (! strncmp( buffer, "processor", 9) ){
 //			printf("found: %s\n", buffer);
 			cpu_count++;
@@ -61,8 +111,7 @@ char * get_cpu_info(json_object *jobj) {
 			tmp = strchr( buffer, ':' );
 			tmp++;
 			while (isspace(*tmp)) tmp++;
-			strcpy(cpu_model, tmp );
-			cpu_model[strlen(cpu_model) - 1] = '\0';
+			strncpy(cpu_model, tmp, BUFFERSIZE);
 //			cpu_model = *tmp;
 //			printf("model: %s\n", cpu_model);
 		}
@@ -76,166 +125,108 @@ char * get_cpu_info(json_object *jobj) {
         json_object_object_add(jobj,"CPUMODEL",json_object_new_string(cpu_model));
 
 	ret[BUFFERSIZE] = '\0';
-	fclose(fd);
+	procfile_free(&cpuinfo_f);
+	done = 1;
 	return(ret);
 }
 char * get_load_avg(json_object *jobj) {
-	FILE *fd;
-	char buffer[BUFFERSIZE+1];
 	static char ret[BUFFERSIZE+1];
-	char *ptr;
-
-	if (( fd = fopen("/proc/loadavg", "r")) == NULL ) {
-		printf("could not open /proc/stat!\n");
-		exit(EXIT_FAILURE);
-	}
-	fgets(buffer, BUFFERSIZE, fd);
+	loadinfo li;
 
-	ptr = (char *)strtok(buffer, " ");
+	must_read(&loadavg_f);
+	scan_loadavg(loadavg_f.buf, loadavg_f.len, &li);
 
 	snprintf(ret, BUFFERSIZE, "LOADAVG=%s\n", 
-		ptr);
+		li.load1);
 
-        json_object_object_add(jobj,"LOADAVG",json_object_new_string(ptr));
+        json_object_object_add(jobj,"LOADAVG",json_object_new_string(li.load1));
 
-	fclose(fd);
 	ret[BUFFERSIZE] = '\0';
 	return(ret);
 }
 
 char * get_cpu_util(json_object *jobj) {
-	FILE *fd;
-	char buffer[BUFFERSIZE+1];
 	static char ret[BUFFERSIZE+1];
-	char *tmp;
-	unsigned long int u_ticks = 0, n_ticks = 0, s_ticks = 0, 
-		i_ticks = 0, t_ticks = 0;
-        static unsigned long int u_ticks_o = 0, n_ticks_o = 0,
-                s_ticks_o = 0, i_ticks_o = 0;
-	unsigned int result;
-
-	if (( fd = fopen("/proc/stat", "r")) == NULL ) {
-		printf("could not open /proc/stat!\n");
-		exit(EXIT_FAILURE);
-	}
-
-	while(!feof(fd)) {
-		fgets(buffer, BUFFERSIZE, fd);
-		if (! strncmp( buffer, "cpu ", 4) ){
-//			printf("found: %s\n", buffer);
-
-			// skip 'cpu'
-			tmp = (char *)strtok(buffer, " ");
+	uint64_t busy, total, now = rate_now();
+	double seconds;
+	unsigned int result = 0;
+	cputicks all;
+
+	must_read(&stat_f);
+	bzero(&all, sizeof(all));
+	scan_stat_cpu(stat_f.buf, stat_f.len, &all);
+
+	// user + nice of user + nice + system + idle, since the last time.
+	// Both are recorded whether or not the other was reset.
+	int b_ok = rate_delta(&rates, "cpu.busy", all.user + all.nice, now, &busy, &seconds);
+	int t_ok = rate_delta(&rates, "cpu.total", all.user + all.nice + all.system + all.idle,
+			      now, &total, &seconds);
+	if ( b_ok && t_ok && total > 0 ) {
+		result = (unsigned int) (busy * 100 / total);
 
-			// user
-			tmp = (char *)strtok(NULL, " ");
-			u_ticks = atoll(tmp);
-
-			// nice
-			tmp = (char *)strtok(NULL, " ");
-			n_ticks = atoll(tmp);
-
-			// system
-			tmp = (char *)strtok(NULL, " ");
-			s_ticks = atoll(tmp);
-
-			// idle
-			tmp = (char *)strtok(NULL, " ");
-			i_ticks = atoll(tmp);
-
-			break;
-		}
-	}
-
-        t_ticks = ((u_ticks + s_ticks + i_ticks + n_ticks) -
-                  (u_ticks_o + s_ticks_o + i_ticks_o + n_ticks_o) );
-
-	if ( t_ticks == 0 ) {
-
-		/* 
-		 * Don't do any calcs because they would fail, 
-		 * and set the return values 
-		*/
-
-		snprintf(ret, BUFFERSIZE, "CPUUTIL=0\n");
-
-        json_object_object_add(jobj,"CPUUTIL",json_object_new_int(result));
-
-		ret[BUFFERSIZE] = '\0';
-
-	} else {
-
-	        result = (int) (((u_ticks - u_ticks_o + n_ticks - n_ticks_o) * 100 ) / t_ticks);
-	
-		// Set the ticks from this loop to again on next loop
-	        u_ticks_o = u_ticks;
-	        n_ticks_o = n_ticks;
-	        s_ticks_o = s_ticks;
-	        i_ticks_o = i_ticks;
-		
 		// In the weird case that we get > 100% cpu utilization
 		result = (result > 100) ? 100 : result; 
-		
-		snprintf(ret, BUFFERSIZE, "CPUUTIL=%d\n",
-			 result);
+	}
 
+	snprintf(ret, BUFFERSIZE, "CPUUTIL=%d\n", result);
         json_object_object_add(jobj,"CPUUTIL",json_object_new_int(result));
+	ret[BUFFERSIZE] = '\0';
 
-		ret[BUFFERSIZE] = '\0';
-	}
-
-	fclose(fd);
 	return(ret);
+}
 
+// CPUUTIL of every cpu, as one array by cpu number: a node with hundreds
+// of them adds one key to the aggregator's work, not hundreds. Returns how
+// many there are.
+int get_cpu_util_percpu(json_object *jobj) {
+	static cputicks cpus[GETSTATS_MAXCPU];
+	json_object *util = json_object_new_array();
+	uint64_t busy, total, now = rate_now();
+	double seconds;
+	char name[RATE_NAMELEN];
+	statinfo st;
+
+	must_read(&stat_f);
+	bzero(&st, sizeof(st));
+	bzero(cpus, sizeof(cpus));
+	st.cpu = cpus;
+	st.maxcpu = GETSTATS_MAXCPU;
+	scan_stat(stat_f.buf, stat_f.len, &st);
+
+	for (int c = 0; c < st.ncpu && c < GETSTATS_MAXCPU; c++) {
+		int result = 0;
+		snprintf(name, sizeof(name), "cpu%d.busy", c);
+		int b_ok = rate_delta(&rates, name, cpus[c].user + cpus[c].nice, now, &busy, &seconds);
+		snprintf(name, sizeof(name), "cpu%d.total", c);
+		int t_ok = rate_delta(&rates, name, cpus[c].user + cpus[c].nice + cpus[c].system + cpus[c].idle,
+				      now, &total, &seconds);
+		if ( b_ok && t_ok && total > 0 ) {
+			result = (int) (busy * 100 / total);
+			result = (result > 100) ? 100 : result;
+		}
+		json_object_array_add(util, json_object_new_int(result));
+	}
+        json_object_object_add(jobj,"CPUUTIL_CPU",util);
+
+	return(st.ncpu);
 }
 
 char * get_mem_stats(json_object *jobj) {
-	FILE *fd;
-	char buffer[BUFFERSIZE+1];
 	static char ret[BUFFERSIZE+1];
-	char *tmp = 0;
 	unsigned long int memt = 0, memf = 0, memb = 0, mema = 0, memc = 0,
 		swapt = 0, swapf = 0;
 	float memp = 0.00, swapp = 0.00;
+	meminfo mi;
 
-	if (( fd = fopen("/proc/meminfo", "r")) == NULL ) {
-		printf("could not open /proc/meminfo!\n");
-		exit(EXIT_FAILURE);
-	}
+	must_read(&meminfo_f);
+	scan_meminfo(meminfo_f.buf, meminfo_f.len, &mi);
+	memt = mi.total;
+	memf = mi.free;
+	memb = mi.buffers;
+	memc = mi.cached;
+	swapt = mi.swaptotal;
+	swapf = mi.swapfree;
 
-	while(!feof(fd)) {
-		fgets(buffer, BUFFERSIZE, fd);
-		if (! strncmp( buffer, "MemTotal:", 9) ){
-			tmp = strchr( buffer, ':' ); // Set a pointer to ':' char in buffer
-			tmp++;                       // +1 to pointer location
-			while (isspace(*tmp)) tmp++; // Increment pointer position til real data
-			memt = atoll(tmp);           // Turn char string into int
-		} else if ( ! strncmp( buffer, "MemFree:", 8) ){
-			tmp = strchr( buffer, ':' );
-			tmp++;
-			while (isspace(*tmp)) tmp++;
-			memf = atoll(tmp);
-		} else if ( ! strncmp( buffer, "Buffers:", 8) ){
-			tmp = strchr( buffer, ':' );
-			tmp++;
-			while (isspace(*tmp)) tmp++;
-			memb = atoll(tmp);
-		} else if ( ! strncmp( buffer, "Cached:", 7) ){
-			tmp = strchr( buffer, ':' );
-			tmp++;
-			while (isspace(*tmp)) tmp++;
-			memc = atoll(tmp);
-		} else if ( ! strncmp( buffer, "SwapTotal:", 10) ){
-			tmp = strchr( buffer, ':' );
-			tmp++;
-			swapt = atoll(tmp);
-		} else if ( ! strncmp( buffer, "SwapFree:", 9) ){
-			tmp = strchr( buffer, ':' );
-			tmp++;
-			swapf = atoll(tmp);
-		}
-
-	}
 	mema = memf + memb + memc;
 //	printf("MEMTOTAL=%lu\nMEMAVAIL=%lu\n", 
 //		memt, memf + memb + memc );
@@ -267,24 +258,24 @@ char * get_mem_stats(json_object *jobj) {
         json_object_object_add(jobj,"SWAPUSED",json_object_new_int((swapt - swapf)/1024));
         json_object_object_add(jobj,"SWAPPERCENT",json_object_new_int(swapp));
 
-	fclose(fd);
 	return(ret);
 }
 
 char * get_node_status(json_object *jobj) {
-	FILE *fd;
 	unsigned int tmp = 0;
 	char buffer[BUFFERSIZE];
 	static char ret[BUFFERSIZE];
 
 	strncpy(buffer, "unavailable\0", 12);
 
-	if((fd = fopen(STATUSFILE, "r")) != NULL) {
-		fgets(buffer, BUFFERSIZE-1, fd);
-		fclose(fd);
+	// Opened each time, it may be replaced rather than written to
+	if(procfile_read(&status_f) >= 0) {
+		strncpy(buffer, status_f.buf, BUFFERSIZE-1);
+		buffer[BUFFERSIZE-1] = '\0';
 	}
+	procfile_close(&status_f);
 
-	while (!isspace(buffer[tmp])) tmp++;
+	while (buffer[tmp] != '\0' && !isspace(buffer[tmp])) tmp++;
 	buffer[tmp] = '\0';
 
 	snprintf(ret, strlen(buffer)+13, "NODESTATUS=%s\n",
@@ -295,84 +286,37 @@ char * get_node_status(json_object *jobj) {
         return(ret);
 }
 
+// Whether NETRECEIVE & NETTRANSMIT count the interface
+int net_counted(const char *name) {
+	return( strcmp("lo", name ) && strcmp("sit0", name ) );
+}
+
 char * get_net_stats(json_object *jobj) {
-	FILE *fd;
-	char buffer[BUFFERSIZE];
 	static char ret[BUFFERSIZE+1];
-	char *ptr;
-	unsigned long long receive = 0, transmit = 0;
 	unsigned long long t_receive = 0, t_transmit = 0;
-	static unsigned long long receive_o = 0, transmit_o = 0;
-
-	
-	if ((fd = fopen("/proc/net/dev", "r")) == NULL) {
-		printf("could not open /proc/net/dev!\n");
-		exit(EXIT_FAILURE);
-	}
-	
-        // skip first two lines
-        fgets(buffer, BUFFERSIZE-1, fd);
-        fgets(buffer, BUFFERSIZE-1, fd);
-
-        while(!feof(fd)) {
-                fgets(buffer, BUFFERSIZE-1, fd);
-
-                ptr = (char *)strtok(buffer, ": ");
-
-		if ( strncmp("lo", ptr, 2 ) || strncmp("sit0", ptr, 4 ) ) {
-
-			ptr = (char *)strtok(NULL, ": ");
-			if(ptr == NULL)
-				break;
-			
-			receive += atoll(ptr);
-
-			ptr = (char *)strtok(NULL, ": ");
-			ptr = (char *)strtok(NULL, ": ");
-			ptr = (char *)strtok(NULL, ": ");
-			ptr = (char *)strtok(NULL, ": ");
-			ptr = (char *)strtok(NULL, ": ");
-			ptr = (char *)strtok(NULL, ": ");
-			ptr = (char *)strtok(NULL, ": ");
-			ptr = (char *)strtok(NULL, ": ");
-
-			transmit += atoll(ptr);
-
-//			printf("-> %s, %llu:%llu, %llu:%llu\n", buffer, receive, receive_o, transmit, transmit_o);
-
+	double receive = 0, transmit = 0, r;
+	uint64_t now = rate_now();
+	char name[RATE_NAMELEN];
+	netif ifs[GETSTATS_MAXIFS];
+	int nifs;
+
+	must_read(&netdev_f);
+	nifs = scan_netdev(netdev_f.buf, netdev_f.len, ifs, GETSTATS_MAXIFS);
+
+	// Bytes/s of each interface on its own, one that was reset or is new
+	// counts from the next time on
+	for (int i = 0; i < nifs && i < GETSTATS_MAXIFS; i++) {
+		if ( net_counted(ifs[i].name) ) {
+			snprintf(name, sizeof(name), "net.%s.rx", ifs[i].name);
+			if ( rate_per_sec(&rates, name, ifs[i].rx_bytes, now, &r) ) receive += r;
+			snprintf(name, sizeof(name), "net.%s.tx", ifs[i].name);
+			if ( rate_per_sec(&rates, name, ifs[i].tx_bytes, now, &r) ) transmit += r;
 		}
-
 	}
 
-	if ( receive_o ) {
-	        // Handle 32 bit counter rollover
-	        t_receive = (receive_o > receive) ?
-	                (UINT_MAX - receive_o) + receive :
-	                receive - receive_o;
-	
-	        t_receive = (unsigned long)(((t_receive / REFRESH) + 512) / 1024);
-	}
-	if ( transmit_o ) {
-	        // Handle 32 bit counter rollover
-	        t_transmit = (transmit_o > transmit) ?
-	                (UINT_MAX - transmit_o) + transmit :
-	                transmit - transmit_o;
-	
-	        t_transmit = (unsigned long)(((t_transmit / REFRESH) + 512) / 1024);
-	}
-/*
-
-	if ( receive_o ) {
-		t_receive = (unsigned long)
-			((((receive - receive_o) / REFRESH) + 512) / 1024) - 1;
-	}
-	if ( transmit_o ) {
-		t_transmit = (unsigned long)
-			((((transmit - transmit_o)/ REFRESH) + 512) / 1024) - 1;
-	}
-*/
-	receive_o = receive;
-	transmit_o = transmit;
+	// In KB/s
+	t_receive = (unsigned long long) ((receive + 512) / 1024);
+	t_transmit = (unsigned long long) ((transmit + 512) / 1024);
 
 	snprintf(ret, BUFFERSIZE, "NETTRANSMIT=%llu\nNETRECIEVE=%llu\n",
 		t_transmit,
@@ -383,10 +327,43 @@ char * get_net_stats(json_object *jobj) {
 
 	ret[BUFFERSIZE] = '\0';
 
-	fclose(fd);
 	return(ret);
 }
 
+// NETRECEIVE & NETTRANSMIT of every interface they count, in arrays in
+// the order of the names in NETIF. Returns how many there are.
+int get_net_stats_perif(json_object *jobj) {
+	json_object *names = json_object_new_array();
+	json_object *rx = json_object_new_array();
+	json_object *tx = json_object_new_array();
+	uint64_t now = rate_now();
+	char name[RATE_NAMELEN];
+	netif ifs[GETSTATS_MAXIFS];
+	double r;
+	int nifs, n = 0;
+
+	must_read(&netdev_f);
+	nifs = scan_netdev(netdev_f.buf, netdev_f.len, ifs, GETSTATS_MAXIFS);
+
+	// Their own counters, apart from those of get_net_stats()
+	for (int i = 0; i < nifs && i < GETSTATS_MAXIFS; i++) {
+		if ( !net_counted(ifs[i].name) ) continue;
+		json_object_array_add(names, json_object_new_string(ifs[i].name));
+		snprintf(name, sizeof(name), "netif.%s.rx", ifs[i].name);
+		if ( !rate_per_sec(&rates, name, ifs[i].rx_bytes, now, &r) ) r = 0;
+		json_object_array_add(rx, json_object_new_int((unsigned long long) ((r + 512) / 1024)));
+		snprintf(name, sizeof(name), "netif.%s.tx", ifs[i].name);
+		if ( !rate_per_sec(&rates, name, ifs[i].tx_bytes, now, &r) ) r = 0;
+		json_object_array_add(tx, json_object_new_int((unsigned long long) ((r + 512) / 1024)));
+		n++;
+	}
+        json_object_object_add(jobj,"NETIF",names);
+        json_object_object_add(jobj,"NETRECEIVE_IF",rx);
+        json_object_object_add(jobj,"NETTRANSMIT_IF",tx);
+
+	return(n);
+}
+
 char * get_sysinfo(json_object *jobj) {
 	struct sysinfo sys_info;
 	static char ret[BUFFERSIZE+1];
@@ -405,12 +382,17 @@ char * get_sysinfo(json_object *jobj) {
 	return(ret);
 }
 
+// Asked for once, it doesn't change while we run
 char * get_uname(json_object *jobj) {
-	struct utsname unameinfo;
+	static struct utsname unameinfo;
+	static int done = 0;
 	static char ret[BUFFERSIZE+1];
 
 	// TODO: Insert your favorite error checking scheme here!
-	uname(&unameinfo);
+	if (!done) {
+		uname(&unameinfo);
+		done = 1;
+	}
 
 	snprintf(ret, BUFFERSIZE, "SYSNAME=%s\nNODENAME=%s\nRELEASE=%s\nVERSION=%s\nMACHINE=%s\n",
 		unameinfo.sysname,
@@ -19,11 +19,14 @@
 char* get_cpu_info(json_object*);
 char* get_load_avg(json_object*);
 char* get_cpu_util(json_object*);
+int get_cpu_util_percpu(json_object*);
 char* get_mem_stats(json_object*);
 char* get_node_status(json_object*);
 char* get_net_stats(json_object*);
+int get_net_stats_perif(json_object*);
 char* get_sysinfo(json_object*);
 char* get_uname(json_object*);
+int net_counted(const char*);
 
 #endif /* _GETSTATS_H */
 
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (history.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "history.h"
+
+// The metrics we keep history for, in column order
+static const char *metric_names[HISTORY_NMETRICS] = {
+  "CPUUTIL", "LOADAVG", "MEMUSED", "MEMPERCENT",
+  "SWAPUSED", "NETTRANSMIT", "NETRECEIVE", "PROCS"
+};
+
+// # of slots per node, fixed before the first sample comes in
+static int nslots = HISTORY_SECS / HISTORY_STEP;
+
+// Keep secs seconds of history per node
+int
+history_setup(int secs)
+{
+  if (secs < HISTORY_STEP) return(-1);
+  nslots = secs / HISTORY_STEP;
+  return(0);
+}
+
+// What each node that reported costs us, in bytes
+size_t
+history_node_size(void)
+{
+  return(sizeof(nodehist) + (size_t) nslots * (sizeof(uint32_t) + HISTORY_NMETRICS * sizeof(float)));
+}
+
+int
+history_nslots(void)
+{
+  return(nslots);
+}
+
+int
+history_metric_id(const char *name)
+{
+  for (int m = 0; m < HISTORY_NMETRICS; m++) {
+    if (strcmp(metric_names[m], name) == 0) return(m);
+  }
+  return(-1);
+}
+
+const char *
+history_metric_name(int m)
+{
+  return(metric_names[m]);
+}
+
+// Numeric value of a key, collectors send some of them (LOADAVG) as strings
+static float
+metric_value(json_object *jobj, const char *name)
+{
+  json_object *val = json_object_object_get(jobj, name);
+  const char *s;
+  char *end;
+  double d;
+
+  if (val == NULL) return(NAN);
+  switch (json_object_get_type(val)) {
+  case json_type_int:
+    return(json_object_get_int(val));
+  case json_type_double:
+    return(json_object_get_double(val));
+  case json_type_string:
+    s = json_object_get_string(val);
+    d = strtod(s, &end);
+    return(end == s ? NAN : d);
+  default:
+    return(NAN);
+  }
+}
+
+// The values of every metric with history in a packet, NAN if it has none
+void
+history_values(json_object *jobj, float *vals)
+{
+  for (int m = 0; m < HISTORY_NMETRICS; m++) {
+    vals[m] = metric_value(jobj, metric_names[m]);
+  }
+}
+
+// A value as it goes out in query replies
+json_object *
+history_value(float v)
+{
+  char buf[32];
+
+  if (isnan(v)) return(NULL);
+  if (v > -2e9 && v < 2e9 && v == (int) v) return(json_object_new_int(v));
+
+  // Only as precise as the float we kept, not its binary expansion
+  snprintf(buf, sizeof(buf), "%.6g", v);
+  return(json_object_new_double(strtod(buf, NULL)));
+}
+
+static nodehist *
+alloc_history(void)
+{
+  nodehist *h = calloc(1, sizeof(nodehist));
+
+  if (h == NULL) return(NULL);
+  // One block, the timestamps followed by each metric's column
+  if ((h->ts = calloc(nslots, sizeof(uint32_t) + HISTORY_NMETRICS * sizeof(float))) == NULL) {
+    free(h);
+    return(NULL);
+  }
+  for (int m = 0; m < HISTORY_NMETRICS; m++) {
+    h->val[m] = (float *) (h->ts + nslots) + (size_t) m * nslots;
+  }
+  return(h);
+}
+
+// Record the metric values of a packet taken at timestamp. A packet older
+// than the sample already in its slot is dropped.
+int
+history_add(nodehist **hp, time_t timestamp, float *vals)
+{
+  nodehist *h = *hp;
+
+  if (timestamp <= 0) return(-1);
+  if (h == NULL && (h = *hp = alloc_history()) == NULL) {
+    perror("calloc");
+    return(-1);
+  }
+
+  int s = (timestamp / HISTORY_STEP) % nslots;
+  if (h->ts[s] > timestamp) return(0);
+
+  h->ts[s] = timestamp;
+  for (int m = 0; m < HISTORY_NMETRICS; m++) {
+    h->val[m][s] = vals[m];
+  }
+  return(0);
+}
+
+// Add the samples taken in [from, to] to out as arrays, TIMESTAMP and one
+// per metric asked for, oldest first. Returns the # of samples.
+int
+history_query(nodehist *h, time_t from, time_t to, int *metrics, int nmetrics, json_object *out)
+{
+  json_object *times = json_object_new_array();
+  json_object *cols[HISTORY_NMETRICS];
+  int n = 0;
+
+  for (int i = 0; i < nmetrics; i++) cols[i] = json_object_new_array();
+
+  // Anything further back than nslots has been overwritten
+  long first = from / HISTORY_STEP, last = to / HISTORY_STEP;
+  if (last - first >= nslots) first = last - nslots + 1;
+
+  for (long t = first; h != NULL && t <= last; t++) {
+    int s = t % nslots;
+    if (h->ts[s] < from || h->ts[s] > to || h->ts[s] / HISTORY_STEP != t) continue;
+
+    json_object_array_add(times, json_object_new_int(h->ts[s]));
+    for (int i = 0; i < nmetrics; i++) {
+      json_object_array_add(cols[i], history_value(h->val[metrics[i]][s]));
+    }
+    n++;
+  }
+
+  json_object_object_add(out, "TIMESTAMP", times);
+  for (int i = 0; i < nmetrics; i++) {
+    json_object_object_add(out, metric_names[metrics[i]], cols[i]);
+  }
+  return(n);
+}
+
+void
+history_free(nodehist *h)
+{
+  if (h == NULL) return;
+  free(h->ts);
+  free(h);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (history.h)
+ *
+ */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H  1
+
+#include <stdint.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+
+// Recent samples of the numeric metrics of one node. Slot s holds the
+// sample taken in [s*HISTORY_STEP, (s+1)*HISTORY_STEP) modulo the # of
+// slots, so there is nothing to search and gaps simply stay stale.
+// Each metric is one contiguous column, range reads walk memory in order.
+typedef struct node_history {
+
+	uint32_t *ts;                      // time of the sample in each slot, 0 if none
+	float    *val[HISTORY_NMETRICS];   // one column per metric, NAN if not reported
+
+} nodehist;
+
+int history_setup(int);
+size_t history_node_size(void);
+int history_nslots(void);
+int history_metric_id(const char*);
+const char *history_metric_name(int);
+void history_values(json_object*, float*);
+json_object *history_value(float);
+int history_add(nodehist**, time_t, float*);
+int history_query(nodehist*, time_t, time_t, int*, int, json_object*);
+void history_free(nodehist*);
+
+#endif /* _HISTORY_H */
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (legacy.c)
+ *
+ */
+
+// Packets of the legacy wulfd (legacy/warewulf-monitor), one datagram of
+// "KEY=VALUE\n" lines sent to LEGACY_PORT. They are turned into what
+// wwmon_collector sends: keys are renamed where wulfd spelled them
+// differently, values typed the same way, and the metrics wulfd leaves
+// out (MEMAVAIL, MEMPERCENT, SWAPFREE, SWAPPERCENT) worked out from the
+// ones it sends.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "legacy.h"
+
+#define AS_INT 0     // integer, a fraction is cut off
+#define AS_STRING 1  // as it is
+#define AS_GUESS 2   // integer, double or string, whatever it looks like
+
+static const struct {
+  const char *name;   // in the packet
+  const char *key;    // ours
+  int type;
+} keys[] = {
+  { "CPUCOUNT", "CPUCOUNT", AS_INT },
+  { "CPUCLOCK", "CPUCLOCK", AS_INT },
+  { "CPUMODEL", "CPUMODEL", AS_STRING },
+  { "CPUUTIL", "CPUUTIL", AS_INT },
+  { "PROCS", "PROCS", AS_INT },
+  { "UPTIME", "UPTIME", AS_INT },
+  { "DISTRO", "DISTRO", AS_STRING },
+  { "SYSNAME", "SYSNAME", AS_STRING },
+  { "NODENAME", "NODENAME", AS_STRING },
+  { "RELEASE", "RELEASE", AS_STRING },
+  { "VERSION", "VERSION", AS_STRING },
+  { "MACHINE", "MACHINE", AS_STRING },
+  { "MEMTOTAL", "MEMTOTAL", AS_INT },
+  { "MEMUSED", "MEMUSED", AS_INT },
+  { "SWAPTOTAL", "SWAPTOTAL", AS_INT },
+  { "SWAPUSED", "SWAPUSED", AS_INT },
+  { "LOADAVG", "LOADAVG", AS_STRING },
+  { "NETRECIEVE", "NETRECEIVE", AS_INT },
+  { "NETTRANSMIT", "NETTRANSMIT", AS_INT },
+  { "USERPROC", "USERPROC", AS_INT },
+  { "NODESTATUS", "NODESTATUS", AS_STRING },
+  { NULL, NULL, 0 }
+};
+
+// The value of s, NULL if it is not all of a number
+static json_object *
+number(const char *s, int type)
+{
+  char *end;
+  long long l;
+  double d;
+
+  if (*s == '\0') return(NULL);
+  errno = 0;
+  l = strtoll(s, &end, 10);
+  if (*end == '\0' && errno == 0) return(json_object_new_int(l));
+  d = strtod(s, &end);
+  if (*end != '\0') return(NULL);
+  return((type == AS_INT) ? json_object_new_int((long long) d) : json_object_new_double(d));
+}
+
+static int
+get(json_object *jobj, const char *key, long *val)
+{
+  json_object *v = json_object_object_get(jobj, key);
+
+  if (v == NULL || !json_object_is_type(v, json_type_int)) return(0);
+  *val = json_object_get_int(v);
+  return(1);
+}
+
+// Turn the len bytes of a packet in buf (with room for one more) into a
+// JSON object, its NODENAME in *nodename. The lines are cut up in place,
+// *nodename points into buf. NULL if it is not a packet of a node, like
+// the empty one wulfd sends when it starts.
+json_object *
+legacy_parse(char *buf, int len, char **nodename)
+{
+  char *p = buf, *end = buf + len;
+  json_object *jobj = NULL;
+
+  *nodename = NULL;
+  buf[len] = '\0';
+
+  while (p < end) {
+    char *nl = memchr(p, '\n', end - p);
+    char *eq;
+    if (nl == NULL) nl = end;
+    *nl = '\0';
+    if (nl > p && nl[-1] == '\r') nl[-1] = '\0';
+
+    if ((eq = memchr(p, '=', nl - p)) != NULL && eq > p) {
+      const char *key = p, *val = eq + 1;
+      int type = AS_GUESS;
+      json_object *v = NULL;
+
+      *eq = '\0';
+      for (int i = 0; keys[i].name != NULL; i++) {
+        if (strcmp(keys[i].name, p) == 0) {
+          key = keys[i].key;
+          type = keys[i].type;
+          break;
+        }
+      }
+      if (type != AS_STRING) v = number(val, type);
+      if (v == NULL) v = json_object_new_string(val);
+
+      if (jobj == NULL) jobj = json_object_new_object();
+      json_object_object_add(jobj, key, v);
+      if (strcmp(key, "NODENAME") == 0) *nodename = (char *) val;
+    }
+    p = nl + 1;
+  }
+
+  if (jobj != NULL && (*nodename == NULL || **nodename == '\0' ||
+                       strlen(*nodename) >= MAX_NODENAME_LEN)) {
+    json_object_put(jobj);
+    jobj = NULL;
+  }
+  if (jobj == NULL) return(NULL);
+
+  long total, used;
+  if (get(jobj, "MEMTOTAL", &total) && get(jobj, "MEMUSED", &used)) {
+    json_object_object_add(jobj, "MEMAVAIL", json_object_new_int(total - used));
+    json_object_object_add(jobj, "MEMPERCENT", json_object_new_int(total > 0 ? used * 100 / total : 0));
+  }
+  if (get(jobj, "SWAPTOTAL", &total) && get(jobj, "SWAPUSED", &used)) {
+    json_object_object_add(jobj, "SWAPFREE", json_object_new_int(total - used));
+    json_object_object_add(jobj, "SWAPPERCENT", json_object_new_int(total > 0 ? used * 100 / total : 0));
+  }
+  return(jobj);
+}
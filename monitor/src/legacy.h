@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (legacy.h)
+ *
+ */
+
+#ifndef _LEGACY_H
+#define _LEGACY_H  1
+
+#include <json/json.h>
+
+#include "globals.h"
+
+json_object *legacy_parse(char*, int, char**);
+
+#endif /* _LEGACY_H */
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (nodetable.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <json/json.h>
+#include <sqlite3.h>
+
+#include "globals.h"
+#include "nodetable.h"
+
+// FNV-1a
+static unsigned int
+hash_name(const char *s)
+{
+  unsigned int h = 2166136261u;
+
+  while (*s) {
+    h ^= (unsigned char) *s++;
+    h *= 16777619u;
+  }
+  return(h);
+}
+
+static nodeent *
+find(nodetable *nt, const char *nodename)
+{
+  nodeent *e = nt->buckets[hash_name(nodename) & (nt->nbuckets - 1)];
+
+  while (e != NULL && strcmp(e->nodename, nodename) != 0) e = e->next;
+  return(e);
+}
+
+// Double the # of buckets, keeps chains short as nodes keep showing up
+static void
+grow(nodetable *nt)
+{
+  int newsize = nt->nbuckets * 2;
+  nodeent **tmp = calloc(newsize, sizeof(nodeent *));
+
+  if (tmp == NULL) return; // Longer chains, but still correct
+
+  for (int i = 0; i < nt->nbuckets; i++) {
+    nodeent *e = nt->buckets[i];
+    while (e != NULL) {
+      nodeent *next = e->next;
+      unsigned int b = hash_name(e->nodename) & (newsize - 1);
+      e->next = tmp[b];
+      tmp[b] = e;
+      e = next;
+    }
+  }
+  free(nt->buckets);
+  nt->buckets = tmp;
+  nt->nbuckets = newsize;
+}
+
+static nodeent *
+add(nodetable *nt, const char *nodename)
+{
+  nodeent *e = calloc(1, sizeof(nodeent));
+
+  if (e == NULL) {
+    perror("calloc");
+    return(NULL);
+  }
+  strncpy(e->nodename, nodename, MAX_NODENAME_LEN-1);
+
+  if (nt->count >= nt->nbuckets) grow(nt);
+  unsigned int b = hash_name(nodename) & (nt->nbuckets - 1);
+  e->next = nt->buckets[b];
+  nt->buckets[b] = e;
+  nt->count++;
+  return(e);
+}
+
+// Refresh the string form of the node after jobj changed
+static int
+serialize(nodeent *e)
+{
+  const char *s = json_object_to_json_string(e->jobj);
+  size_t len = strlen(s) + 1;
+
+  if (len > e->blob_size) {
+    char *tmp = realloc(e->blob, len);
+    if (tmp == NULL) {
+      perror("realloc");
+      return(-1);
+    }
+    e->blob = tmp;
+    e->blob_size = len;
+  }
+  memcpy(e->blob, s, len);
+  return(0);
+}
+
+// Add the keys of from that into does not have yet
+static void
+merge_missing(json_object *into, json_object *from)
+{
+  json_object_object_foreach(from, key, value) {
+    if (json_object_object_get(into, key) == NULL) {
+      json_object_object_add(into, key, json_object_get(value));
+    }
+  }
+}
+
+int
+nodetable_init(nodetable *nt)
+{
+  bzero(nt, sizeof(nodetable));
+  if ((nt->buckets = calloc(NODETABLE_MINSIZE, sizeof(nodeent *))) == NULL) {
+    perror("calloc");
+    return(-1);
+  }
+  nt->nbuckets = NODETABLE_MINSIZE;
+  pthread_rwlock_init(&nt->lock, NULL);
+  return(0);
+}
+
+// Start out with what the datastore had when we were last running
+int
+nodetable_load(nodetable *nt, sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  char sqlcmd[MAX_SQL_SIZE];
+  int n = 0;
+
+  snprintf(sqlcmd, MAX_SQL_SIZE, "select nodename, timestamp, jsonblob from %s", SQLITE_DB_TB1NAME);
+  if (sqlite3_prepare_v2(db, sqlcmd, -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    return(-1);
+  }
+
+  pthread_rwlock_wrlock(&nt->lock);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *nodename = (const char *) sqlite3_column_text(stmt, 0);
+    const char *blob = (const char *) sqlite3_column_text(stmt, 2);
+    json_object *jobj;
+    nodeent *e;
+
+    if (nodename == NULL || blob == NULL) continue;
+    if ((jobj = json_tokener_parse(blob)) == NULL) continue;
+    if (find(nt, nodename) != NULL || (e = add(nt, nodename)) == NULL) {
+      json_object_put(jobj);
+      continue;
+    }
+    e->timestamp = sqlite3_column_int64(stmt, 1);
+    e->jobj = jobj;
+    e->rra = rra_open(nodename);
+    e->rra_tried = 1;
+    serialize(e);
+    n++;
+  }
+  pthread_rwlock_unlock(&nt->lock);
+
+  sqlite3_finalize(stmt);
+  return(n);
+}
+
+// Merge a packet from a node into what we have of it, with the lock held
+// for writing. Keys of a newer packet replace ours, an older packet only
+// fills in keys we lack. A delta is applied unless it is older: the
+// collector counts what it holds as delivered, so one with our time stamp
+// (two within a second) must not be thrown away.
+static int
+update(nodetable *nt, char *nodename, time_t timestamp, json_object *jobj)
+{
+  nodeent *e;
+  int rc = 0;
+
+  if ((e = find(nt, nodename)) == NULL && (e = add(nt, nodename)) == NULL) {
+    return(-1);
+  }
+
+  // A collector sending only what changed since its last packet
+  int isdelta = (json_object_object_get(jobj, "DELTA") != NULL);
+  if (isdelta) json_object_object_del(jobj, "DELTA");
+
+  // Only what this packet reported, before older keys are merged into it
+  float vals[HISTORY_NMETRICS];
+  history_values(jobj, vals);
+
+  if (e->jobj == NULL) { // PKT with data from a new node
+    e->timestamp = timestamp;
+    e->jobj = json_object_get(jobj);
+  } else if (e->timestamp <= timestamp && isdelta) { // Newer PKT with the changes only
+    // Put them into what we have, the other keys still hold
+    json_object_object_foreach(jobj, key, value) {
+      json_object_object_add(e->jobj, key, json_object_get(value));
+    }
+    e->timestamp = timestamp;
+    history_values(e->jobj, vals);
+  } else if (e->timestamp < timestamp) { // PKT with newer time stamp
+    merge_missing(jobj, e->jobj);
+    json_object_put(e->jobj);
+    e->jobj = json_object_get(jobj);
+    e->timestamp = timestamp;
+  } else { // PKT with same time stamp or with older time stamp
+    if (isdelta) {
+      printf("Older delta from %s (%ld, have %ld), only keys we lack are kept\n",
+             nodename, (long) timestamp, (long) e->timestamp);
+    }
+    merge_missing(e->jobj, jobj);
+  }
+
+  history_add(&e->hist, timestamp, vals);
+  if (!e->rra_tried) {
+    e->rra = rra_open(nodename);
+    e->rra_tried = 1;
+  }
+  rra_add(e->rra, timestamp, vals);
+
+  rc = serialize(e);
+  e->gen++;
+  __atomic_add_fetch(&nt->gen, 1, __ATOMIC_RELEASE);
+  if (!e->dirty) {
+    e->dirty = 1;
+    nt->ndirty++;
+  }
+
+  return(rc);
+}
+
+// Takes the caller's reference to jobj. The table shares its objects with
+// what it keeps of the node, and json-c counts references without atomics,
+// so the reference is dropped here with the lock still held.
+int
+nodetable_update(nodetable *nt, char *nodename, time_t timestamp, json_object *jobj)
+{
+  int rc;
+
+  pthread_rwlock_wrlock(&nt->lock);
+  rc = update(nt, nodename, timestamp, jobj);
+  json_object_put(jobj);
+  pthread_rwlock_unlock(&nt->lock);
+  return(rc);
+}
+
+// Merge n packets taking the lock once, for ingest paths that read many
+// at a time. Takes the references to them like nodetable_update(). Returns
+// how many could not be merged.
+int
+nodetable_update_many(nodetable *nt, nodesample *samples, int n)
+{
+  int failed = 0;
+
+  pthread_rwlock_wrlock(&nt->lock);
+  for (int i = 0; i < n; i++) {
+    if (update(nt, samples[i].nodename, samples[i].timestamp, samples[i].jobj) < 0) failed++;
+    json_object_put(samples[i].jobj);
+  }
+  pthread_rwlock_unlock(&nt->lock);
+  return(failed);
+}
+
+// Add every node to out the way a query of the datastore would, nodename
+// to JSON string, and the # of them as JSON_CT
+int
+nodetable_dump(nodetable *nt, json_object *out)
+{
+  int n = 0;
+
+  pthread_rwlock_rdlock(&nt->lock);
+  for (int i = 0; i < nt->nbuckets; i++) {
+    for (nodeent *e = nt->buckets[i]; e != NULL; e = e->next) {
+      if (e->blob == NULL) continue;
+      json_object_object_add(out, e->nodename, json_object_new_string(e->blob));
+      n++;
+    }
+  }
+  pthread_rwlock_unlock(&nt->lock);
+
+  json_object_object_add(out, "JSON_CT", json_object_new_int(n));
+  return(n);
+}
+
+// Add the nodes that pass filter f to out like nodetable_dump() does
+int
+nodetable_select(nodetable *nt, filter *f, json_object *out)
+{
+  int n = 0;
+
+  pthread_rwlock_rdlock(&nt->lock);
+  for (int i = 0; i < nt->nbuckets; i++) {
+    for (nodeent *e = nt->buckets[i]; e != NULL; e = e->next) {
+      if (e->blob == NULL || !filter_match(f, e->nodename, e->jobj)) continue;
+      json_object_object_add(out, e->nodename, json_object_new_string(e->blob));
+      n++;
+    }
+  }
+  pthread_rwlock_unlock(&nt->lock);
+
+  json_object_object_add(out, "JSON_CT", json_object_new_int(n));
+  return(n);
+}
+
+static void
+add_history(nodeent *e, int step, int func, time_t from, time_t to, int *metrics, int nmetrics, json_object *out)
+{
+  json_object *h = json_object_new_object();
+
+  if (step <= HISTORY_STEP) {
+    history_query(e->hist, from, to, metrics, nmetrics, h);
+  } else {
+    rra_query(e->rra, step, func, from, to, metrics, nmetrics, h);
+  }
+  json_object_object_add(out, e->nodename, json_object_new_string(json_object_to_json_string(h)));
+  json_object_put(h);
+}
+
+// Add the history of the nodes that pass filter f to out as nodename to
+// JSON string. Resolutions coarser than HISTORY_STEP come from the
+// archives, as the rollup func of each of their intervals.
+// The # of nodes goes in JSON_CT.
+int
+nodetable_history(nodetable *nt, filter *f, int step, int func, time_t from, time_t to, int *metrics, int nmetrics, json_object *out)
+{
+  int n = 0;
+
+  pthread_rwlock_rdlock(&nt->lock);
+  for (int i = 0; i < nt->nbuckets; i++) {
+    for (nodeent *e = nt->buckets[i]; e != NULL; e = e->next) {
+      if (e->jobj == NULL || !filter_match(f, e->nodename, e->jobj)) continue;
+      add_history(e, step, func, from, to, metrics, nmetrics, out);
+      n++;
+    }
+  }
+  pthread_rwlock_unlock(&nt->lock);
+
+  json_object_object_add(out, "JSON_CT", json_object_new_int(n));
+  return(n);
+}
+
+// Free the in memory history of nodes that have not reported since
+// before, all of it is older than what we keep anyway. Their archives
+// hold on to the rollups. Returns the # of nodes expired.
+int
+nodetable_expire(nodetable *nt, time_t before)
+{
+  int n = 0;
+
+  pthread_rwlock_wrlock(&nt->lock);
+  for (int i = 0; i < nt->nbuckets; i++) {
+    for (nodeent *e = nt->buckets[i]; e != NULL; e = e->next) {
+      if (e->hist == NULL || e->timestamp >= before) continue;
+      history_free(e->hist);
+      e->hist = NULL;
+      n++;
+    }
+  }
+  if (n > 0) __atomic_add_fetch(&nt->gen, 1, __ATOMIC_RELEASE);
+  pthread_rwlock_unlock(&nt->lock);
+  return(n);
+}
+
+// Call func(arg, e) for every node passing f with the table locked for
+// reading, func may look at e but not keep any of it
+int
+nodetable_walk(nodetable *nt, filter *f, void (*func)(void*, nodeent*), void *arg)
+{
+  int n = 0;
+
+  pthread_rwlock_rdlock(&nt->lock);
+  for (int i = 0; i < nt->nbuckets; i++) {
+    for (nodeent *e = nt->buckets[i]; e != NULL; e = e->next) {
+      if (e->blob == NULL || !filter_match(f, e->nodename, e->jobj)) continue;
+      func(arg, e);
+      n++;
+    }
+  }
+  pthread_rwlock_unlock(&nt->lock);
+  return(n);
+}
+
+// Current generation of the table, read without taking the lock. Take it
+// before building a reply, a change while building then shows as a newer one.
+uint64_t
+nodetable_gen(nodetable *nt)
+{
+  return(__atomic_load_n(&nt->gen, __ATOMIC_ACQUIRE));
+}
+
+// Copy out the nodes changed since the last call and mark them clean,
+// so the datastore can be written without holding up ingest.
+// Returns the # of nodes in *out, which nodetable_free_dirty releases.
+int
+nodetable_take_dirty(nodetable *nt, nodeflush **out)
+{
+  nodeflush *f;
+  int n = 0;
+
+  *out = NULL;
+  pthread_rwlock_wrlock(&nt->lock);
+  if (nt->ndirty == 0 || (f = calloc(nt->ndirty, sizeof(nodeflush))) == NULL) {
+    pthread_rwlock_unlock(&nt->lock);
+    return(0);
+  }
+  for (int i = 0; i < nt->nbuckets && n < nt->ndirty; i++) {
+    for (nodeent *e = nt->buckets[i]; e != NULL; e = e->next) {
+      if (!e->dirty || e->blob == NULL) continue;
+      if ((f[n].blob = strdup(e->blob)) == NULL) continue; // Try again next time
+      strcpy(f[n].nodename, e->nodename);
+      f[n].timestamp = e->timestamp;
+      e->dirty = 0;
+      n++;
+    }
+  }
+  nt->ndirty -= n;
+  pthread_rwlock_unlock(&nt->lock);
+
+  *out = f;
+  return(n);
+}
+
+void
+nodetable_free_dirty(nodeflush *f, int n)
+{
+  for (int i = 0; i < n; i++) free(f[i].blob);
+  free(f);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (nodetable.h)
+ *
+ */
+
+#ifndef _NODETABLE_H
+#define _NODETABLE_H  1
+
+#include <time.h>
+#include <pthread.h>
+#include <json/json.h>
+#include <sqlite3.h>
+
+#include "globals.h"
+#include "history.h"
+#include "rra.h"
+#include "filter.h"
+
+// Latest merged metrics of one node
+typedef struct node_entry {
+
+	char    nodename[MAX_NODENAME_LEN];
+	time_t  timestamp;     // of the newest packet merged in
+	json_object *jobj;     // merged metrics, changed with the lock held for writing,
+	                       // only read with accessors that don't cache
+	char    *blob;         // jobj as a JSON string, what queries & flushes hand out
+	size_t  blob_size;     // allocated size of blob
+	int     dirty;         // changed since it was last written to the datastore
+	nodehist *hist;        // recent samples, NULL till the first packet
+	rrafile *rra;          // long term archive, NULL if there is none
+	int     rra_tried;     // rra_open() was called already
+	uint64_t gen;          // # of packets merged in
+
+	struct node_entry *next;  // next in the hash chain
+
+} nodeent;
+
+// The aggregator's authoritative copy of every node's state, keyed by
+// nodename. The datastore is only written behind it.
+typedef struct node_table {
+
+	pthread_rwlock_t lock;
+	nodeent **buckets;
+	int     nbuckets;   // always a power of 2
+	int     count;      // # of nodes
+	int     ndirty;     // # of nodes with dirty set
+	uint64_t gen;       // moves whenever any node does, so a reply built at one
+	                    // generation is still good while it is the current one
+
+} nodetable;
+
+// A dirty node copied out of the table to be written to the datastore
+typedef struct node_flush {
+
+	char    nodename[MAX_NODENAME_LEN];
+	time_t  timestamp;
+	char    *blob;
+
+} nodeflush;
+
+// A packet from a node, for merging many at once
+typedef struct node_sample {
+
+	char    *nodename;
+	time_t  timestamp;
+	json_object *jobj;
+
+} nodesample;
+
+int nodetable_init(nodetable*);
+int nodetable_load(nodetable*, sqlite3*);
+int nodetable_update(nodetable*, char*, time_t, json_object*);
+int nodetable_update_many(nodetable*, nodesample*, int);
+int nodetable_dump(nodetable*, json_object*);
+int nodetable_select(nodetable*, filter*, json_object*);
+int nodetable_history(nodetable*, filter*, int, int, time_t, time_t, int*, int, json_object*);
+int nodetable_expire(nodetable*, time_t);
+int nodetable_walk(nodetable*, filter*, void (*)(void*, nodeent*), void*);
+uint64_t nodetable_gen(nodetable*);
+int nodetable_take_dirty(nodetable*, nodeflush**);
+void nodetable_free_dirty(nodeflush*, int);
+
+#endif /* _NODETABLE_H */
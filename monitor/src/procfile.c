@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (procfile.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procfile.h"
+
+// Read all of pf again. Returns its length, or -1 if it can't be opened
+// or read (it is tried again next time).
+int
+procfile_read(procfile *pf)
+{
+  ssize_t n;
+
+  if (pf->fd < 0 && (pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC)) < 0) return(-1);
+  if (pf->buf == NULL) {
+    if ((pf->buf = malloc(PROCFILE_MINSIZE)) == NULL) {
+      perror("malloc");
+      return(-1);
+    }
+    pf->size = PROCFILE_MINSIZE;
+  }
+
+  // /proc files are made as they are read, from offset 0 on each time
+  pf->len = 0;
+  while (1) {
+    if (pf->len + 1 >= pf->size) {
+      char *tmp = realloc(pf->buf, pf->size * 2);
+      if (tmp == NULL) {
+        perror("realloc");
+        return(-1);
+      }
+      pf->buf = tmp;
+      pf->size *= 2;
+    }
+    if ((n = pread(pf->fd, pf->buf + pf->len, pf->size - pf->len - 1, pf->len)) < 0) {
+      if (errno == EINTR) continue;
+      // Gone (like a status file that was replaced), open it again next time
+      procfile_close(pf);
+      return(-1);
+    }
+    if (n == 0) break;
+    pf->len += n;
+  }
+  pf->buf[pf->len] = '\0';
+  return(pf->len);
+}
+
+// Close pf, the buffer is kept for when it is read again
+void
+procfile_close(procfile *pf)
+{
+  if (pf->fd >= 0) close(pf->fd);
+  pf->fd = -1;
+}
+
+void
+procfile_free(procfile *pf)
+{
+  procfile_close(pf);
+  free(pf->buf);
+  pf->buf = NULL;
+  pf->size = pf->len = 0;
+}
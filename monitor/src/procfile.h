@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (procfile.h)
+ *
+ */
+
+#ifndef _PROCFILE_H
+#define _PROCFILE_H  1
+
+#include <stddef.h>
+
+#define PROCFILE_MINSIZE 4096  // Initial size of the buffer, grown to fit
+
+// A file under /proc read again and again: opened once and re-read from
+// the start with pread() into a buffer that is kept
+typedef struct proc_file {
+
+	const char *path;
+	int     fd;        // -1 till opened
+	char    *buf;      // contents as of the last read, NUL terminated
+	size_t  size;      // allocated size of buf
+	size_t  len;       // bytes in buf
+
+} procfile;
+
+#define PROCFILE_INIT(path) { path, -1, NULL, 0, 0 }
+
+int procfile_read(procfile*);
+void procfile_close(procfile*);
+void procfile_free(procfile*);
+
+#endif /* _PROCFILE_H */
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (procscan.c)
+ *
+ */
+
+// Scanners of /proc files as read into a buffer (see procfile.c). Each
+// goes over the buffer once, doesn't write to it and allocates nothing,
+// lines they have no use for are skipped with memchr(). The intr line of
+// /proc/stat alone is thousands of numbers on a big node.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "procscan.h"
+
+// Whether 8 bytes at p are all digits, then their value, the way
+// "SWAR" parsing does it: digit pairs, then quads, then all 8 at once
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static inline int
+digits8(const char *p, uint64_t *val)
+{
+  uint64_t v;
+
+  memcpy(&v, p, 8);
+  if (((v & 0xf0f0f0f0f0f0f0f0ull) | (((v + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4))
+      != 0x3030303030303030ull + 0x0303030303030303ull)
+    return(0);
+  v = ((v & 0x0f0f0f0f0f0f0f0full) * 2561) >> 8;
+  v = ((v & 0x00ff00ff00ff00ffull) * 6553601) >> 16;
+  *val = ((v & 0x0000ffff0000ffffull) * 42949672960001ull) >> 32;
+  return(1);
+}
+#else
+static inline int
+digits8(const char *p, uint64_t *val)
+{
+  return(0);
+}
+#endif
+
+// The unsigned number at *p (after any blanks), *p left after it
+static inline uint64_t
+number(const char **p, const char *end)
+{
+  const char *s = *p;
+  uint64_t n = 0, eight;
+
+  while (s < end && (*s == ' ' || *s == '\t')) s++;
+  while (end - s >= 8 && digits8(s, &eight)) {
+    n = n * 100000000ull + eight;
+    s += 8;
+  }
+  while (s < end && (unsigned) (*s - '0') < 10) n = n * 10 + (*s++ - '0');
+  *p = s;
+  return(n);
+}
+
+// Past the end of the line p is in
+static inline const char *
+eol(const char *p, const char *end)
+{
+  const char *nl = memchr(p, '\n', end - p);
+  return(nl ? nl + 1 : end);
+}
+
+// Copy the name at *p, ending at a blank or ':', into name
+static inline void
+name(const char **p, const char *end, char *name)
+{
+  const char *s = *p;
+  int n = 0;
+
+  while (s < end && (*s == ' ' || *s == '\t')) s++;
+  while (s < end && *s != ' ' && *s != ':' && *s != '\n') {
+    if (n < PROCSCAN_NAMELEN - 1) name[n++] = *s;
+    s++;
+  }
+  name[n] = '\0';
+  if (s < end && *s == ':') s++;
+  *p = s;
+}
+
+static inline int
+starts(const char *p, const char *end, const char *word, size_t len)
+{
+  return(end - p >= len && memcmp(p, word, len) == 0);
+}
+
+static void
+ticks(const char **p, const char *end, cputicks *t)
+{
+  t->user = number(p, end);
+  t->nice = number(p, end);
+  t->system = number(p, end);
+  t->idle = number(p, end);
+  t->iowait = number(p, end);
+  t->irq = number(p, end);
+  t->softirq = number(p, end);
+  t->steal = number(p, end);
+}
+
+// Returns 0, or -1 if there is no "cpu " line
+int
+scan_stat(const char *buf, size_t len, statinfo *st)
+{
+  const char *p = buf, *end = buf + len;
+  int found = 0;
+
+  st->ncpu = 0;
+  while (p < end) {
+    if (starts(p, end, "cpu", 3)) {
+      p += 3;
+      if (p < end && *p == ' ') {
+        ticks(&p, end, &st->all);
+        found = 1;
+      } else {
+        uint64_t n = number(&p, end);
+        if (n >= st->ncpu) st->ncpu = n + 1;
+        if (st->cpu != NULL && n < st->maxcpu) ticks(&p, end, &st->cpu[n]);
+      }
+    } else if (starts(p, end, "ctxt ", 5)) {
+      p += 5;
+      st->ctxt = number(&p, end);
+    } else if (starts(p, end, "procs_running ", 14)) {
+      p += 14;
+      st->procs_running = number(&p, end);
+    } else if (starts(p, end, "procs_blocked ", 14)) {
+      p += 14;
+      st->procs_blocked = number(&p, end);
+    }
+    p = eol(p, end);
+  }
+  return(found ? 0 : -1);
+}
+
+// Only the "cpu " line of /proc/stat into *all, which is the first one:
+// the rest is not even looked at, the cpuN and intr lines are most of the
+// file on a big node. Returns 0, or -1 if there is no such line.
+int
+scan_stat_cpu(const char *buf, size_t len, cputicks *all)
+{
+  const char *p = buf, *end = buf + len;
+
+  for (; p < end; p = eol(p, end)) {
+    if (starts(p, end, "cpu ", 4)) {
+      p += 4;
+      ticks(&p, end, all);
+      return(0);
+    }
+  }
+  return(-1);
+}
+
+// Returns the # of the fields wanted that were found
+int
+scan_meminfo(const char *buf, size_t len, meminfo *mi)
+{
+  static const struct {
+    const char *key;
+    size_t len;
+    size_t off;
+  } keys[] = {
+    { "MemTotal:", 9, offsetof(meminfo, total) },
+    { "MemFree:", 8, offsetof(meminfo, free) },
+    { "MemAvailable:", 13, offsetof(meminfo, available) },
+    { "Buffers:", 8, offsetof(meminfo, buffers) },
+    { "Cached:", 7, offsetof(meminfo, cached) },
+    { "SwapTotal:", 10, offsetof(meminfo, swaptotal) },
+    { "SwapFree:", 9, offsetof(meminfo, swapfree) },
+  };
+  const int nkeys = sizeof(keys) / sizeof(keys[0]);
+  const char *p = buf, *end = buf + len;
+  int found = 0, k = 0;
+
+  bzero(mi, sizeof(meminfo));
+  // They come in this order, so the next one wanted is tried first
+  while (p < end && found < nkeys) {
+    for (int i = 0; i < nkeys; i++, k = (k + 1) % nkeys) {
+      if (starts(p, end, keys[k].key, keys[k].len)) {
+        p += keys[k].len;
+        *(uint64_t *) ((char *) mi + keys[k].off) = number(&p, end);
+        found++;
+        k = (k + 1) % nkeys;
+        break;
+      }
+    }
+    p = eol(p, end);
+  }
+  return(found);
+}
+
+// Fill in up to max interfaces, returns how many there are
+int
+scan_netdev(const char *buf, size_t len, netif *ifs, int max)
+{
+  const char *p = buf, *end = buf + len;
+  int n = 0;
+
+  // Two lines of headings
+  p = eol(p, end);
+  p = eol(p, end);
+  while (p < end) {
+    if (n < max) {
+      netif *ifp = &ifs[n];
+      name(&p, end, ifp->name);
+      ifp->rx_bytes = number(&p, end);
+      ifp->rx_packets = number(&p, end);
+      for (int i = 0; i < 6; i++) number(&p, end); // errs drop fifo frame compressed multicast
+      ifp->tx_bytes = number(&p, end);
+      ifp->tx_packets = number(&p, end);
+    }
+    n++;
+    p = eol(p, end);
+  }
+  return(n);
+}
+
+int
+scan_loadavg(const char *buf, size_t len, loadinfo *li)
+{
+  const char *p = buf, *end = buf + len;
+  int i = 0;
+
+  while (p < end && *p == ' ') p++;
+  for (; p + i < end && p[i] != ' ' && i < sizeof(li->load1) - 1; i++) li->load1[i] = p[i];
+  li->load1[i] = '\0';
+
+  // Fixed point, like "0.73", the kernel writes two decimals
+  for (int l = 0; l < 3; l++) {
+    uint64_t whole = number(&p, end), frac = 0, scale = 1;
+    if (p < end && *p == '.') {
+      const char *f = ++p;
+      frac = number(&p, end);
+      for (; f < p; f++) scale *= 10;
+    }
+    li->load[l] = whole + (double) frac / scale;
+  }
+  li->running = number(&p, end);
+  if (p < end && *p == '/') p++;
+  li->total = number(&p, end);
+  return(li->load1[0] != '\0' ? 0 : -1);
+}
+
+// Fill in up to max disks, returns how many there are
+int
+scan_diskstats(const char *buf, size_t len, diskio *d, int max)
+{
+  const char *p = buf, *end = buf + len;
+  int n = 0;
+
+  while (p < end) {
+    if (n < max) {
+      diskio *dp = &d[n];
+      number(&p, end); // major
+      number(&p, end); // minor
+      name(&p, end, dp->name);
+      dp->reads = number(&p, end);
+      number(&p, end); // reads merged
+      dp->sectors_read = number(&p, end);
+      number(&p, end); // ms reading
+      dp->writes = number(&p, end);
+      number(&p, end); // writes merged
+      dp->sectors_written = number(&p, end);
+      number(&p, end); // ms writing
+      number(&p, end); // in flight
+      dp->io_ms = number(&p, end);
+    }
+    n++;
+    p = eol(p, end);
+  }
+  return(n);
+}
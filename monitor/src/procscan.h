@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (procscan.h)
+ *
+ */
+
+#ifndef _PROCSCAN_H
+#define _PROCSCAN_H  1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROCSCAN_NAMELEN 32  // Longest interface or disk name kept
+
+// Ticks of a "cpu" line of /proc/stat
+typedef struct cpu_ticks {
+
+	uint64_t user;
+	uint64_t nice;
+	uint64_t system;
+	uint64_t idle;
+	uint64_t iowait;
+	uint64_t irq;
+	uint64_t softirq;
+	uint64_t steal;
+
+} cputicks;
+
+// /proc/stat
+typedef struct stat_info {
+
+	cputicks all;      // the "cpu " line
+	cputicks *cpu;     // "cpuN" lines by N, up to maxcpu of them, may be NULL
+	int     maxcpu;
+	int     ncpu;      // highest N seen + 1
+	uint64_t ctxt;
+	uint64_t procs_running;
+	uint64_t procs_blocked;
+
+} statinfo;
+
+// /proc/meminfo, in kB
+typedef struct mem_info {
+
+	uint64_t total;
+	uint64_t free;
+	uint64_t available;
+	uint64_t buffers;
+	uint64_t cached;
+	uint64_t swaptotal;
+	uint64_t swapfree;
+
+} meminfo;
+
+// A line of /proc/net/dev
+typedef struct net_if {
+
+	char    name[PROCSCAN_NAMELEN];
+	uint64_t rx_bytes;
+	uint64_t rx_packets;
+	uint64_t tx_bytes;
+	uint64_t tx_packets;
+
+} netif;
+
+// /proc/loadavg
+typedef struct load_info {
+
+	char    load1[16];   // as it is written, the way LOADAVG is sent
+	double  load[3];
+	uint64_t running;
+	uint64_t total;
+
+} loadinfo;
+
+// A line of /proc/diskstats
+typedef struct disk_io {
+
+	char    name[PROCSCAN_NAMELEN];
+	uint64_t reads;
+	uint64_t sectors_read;
+	uint64_t writes;
+	uint64_t sectors_written;
+	uint64_t io_ms;
+
+} diskio;
+
+int scan_stat(const char*, size_t, statinfo*);
+int scan_stat_cpu(const char*, size_t, cputicks*);
+int scan_meminfo(const char*, size_t, meminfo*);
+int scan_netdev(const char*, size_t, netif*, int);
+int scan_loadavg(const char*, size_t, loadinfo*);
+int scan_diskstats(const char*, size_t, diskio*, int);
+
+#endif /* _PROCSCAN_H */
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (qcache.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "globals.h"
+#include "util.h"
+#include "qcache.h"
+
+static long
+now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec * 1000L + ts.tv_nsec / 1000000);
+}
+
+// FNV-1a, like the node table
+static unsigned int
+hash(const char *key)
+{
+  unsigned int h = 2166136261u;
+
+  while (*key != '\0') {
+    h ^= (unsigned char) *key++;
+    h *= 16777619u;
+  }
+  return(h % QCACHE_BUCKETS);
+}
+
+// Serve a reply for up to ttl ms after the data it was built from changed,
+// 0 to only serve it while nothing changed and -1 to cache nothing
+int
+qcache_init(qcache *qc, int ttl)
+{
+  bzero(qc, sizeof(qcache));
+  qc->ttl = ttl;
+  if (pthread_rwlock_init(&qc->lock, NULL) != 0) {
+    perror("pthread_rwlock_init");
+    return(-1);
+  }
+  return(0);
+}
+
+int
+qcache_enabled(qcache *qc)
+{
+  return(qc->ttl >= 0);
+}
+
+// Append in to the key being built in out, with every run of white space
+// made one blank, so queries differing only in spacing share a reply.
+// Returns -1 if it does not fit, the key can not stand for the query then.
+int
+qcache_normalize(char *out, int outlen, const char *in)
+{
+  int n = strlen(out);
+  int blank = 0;
+
+  if (in == NULL) return(0);
+  while (isspace((unsigned char) *in)) in++;
+  for (; *in != '\0' && n < outlen - 1; in++) {
+    if (isspace((unsigned char) *in)) {
+      blank = 1;
+      continue;
+    }
+    if (blank && n < outlen - 2) out[n++] = ' ';
+    blank = 0;
+    out[n++] = *in;
+  }
+  out[n] = '\0';
+  return(*in == '\0' ? 0 : -1);
+}
+
+static qcentry *
+find(qcache *qc, const char *key)
+{
+  qcentry *e;
+
+  for (e = qc->buckets[hash(key)]; e != NULL && strcmp(e->key, key) != 0; e = e->next);
+  return(e);
+}
+
+// Queue the cached reply to key if it is still good for data at generation
+// gen. Returns 1 if it was queued, 0 if the reply has to be built and -1
+// if queueing failed.
+int
+qcache_get(qcache *qc, const char *key, uint64_t gen, outqueue *q, char *nodename)
+{
+  qcentry *e;
+  int rc = 0;
+
+  if (!qcache_enabled(qc)) return(0);
+
+  pthread_rwlock_rdlock(&qc->lock);
+  if ((e = find(qc, key)) != NULL && (e->gen == gen || now_ms() - e->built < qc->ttl)) {
+    rc = (outq_add_frame(q, e->reply, e->len, e->flags, nodename) < 0) ? -1 : 1;
+  }
+  pthread_rwlock_unlock(&qc->lock);
+
+  __atomic_add_fetch(rc == 1 ? &qc->hits : &qc->misses, 1, __ATOMIC_RELAXED);
+  return(rc);
+}
+
+static void
+drop(qcache *qc, qcentry *e)
+{
+  qcentry **pe;
+
+  for (pe = &qc->buckets[hash(e->key)]; *pe != e; pe = &(*pe)->next);
+  *pe = e->next;
+  qc->count--;
+  qc->bytes -= e->len;
+  free(e->key);
+  free(e->reply);
+  free(e);
+}
+
+// Make room for a reply of len bytes, the oldest go first
+static void
+evict(qcache *qc, size_t len)
+{
+  while (qc->count > 0 && (qc->count >= QCACHE_MAXENTRIES || qc->bytes + len > QCACHE_MAXBYTES)) {
+    qcentry *oldest = NULL;
+    for (int i = 0; i < QCACHE_BUCKETS; i++) {
+      for (qcentry *e = qc->buckets[i]; e != NULL; e = e->next) {
+        if (oldest == NULL || e->built < oldest->built) oldest = e;
+      }
+    }
+    drop(qc, oldest);
+  }
+}
+
+// Keep the reply to key, built from data at generation gen and encoded as
+// the APPHDR_ flags say
+void
+qcache_put(qcache *qc, const char *key, uint64_t gen, const char *reply, size_t len, int flags)
+{
+  qcentry *e;
+  char *copy;
+
+  if (!qcache_enabled(qc) || len > QCACHE_MAXBYTES) return;
+  if ((copy = malloc(len)) == NULL) return;
+  memcpy(copy, reply, len);
+
+  pthread_rwlock_wrlock(&qc->lock);
+  if ((e = find(qc, key)) != NULL) {
+    // Another worker may have built a newer one meanwhile
+    if (e->gen > gen) {
+      pthread_rwlock_unlock(&qc->lock);
+      free(copy);
+      return;
+    }
+    drop(qc, e);
+  }
+  evict(qc, len);
+  if ((e = calloc(1, sizeof(qcentry))) == NULL || (e->key = strdup(key)) == NULL) {
+    pthread_rwlock_unlock(&qc->lock);
+    free(e);
+    free(copy);
+    return;
+  }
+  e->gen = gen;
+  e->built = now_ms();
+  e->reply = copy;
+  e->len = len;
+  e->flags = flags;
+  unsigned int b = hash(key);
+  e->next = qc->buckets[b];
+  qc->buckets[b] = e;
+  qc->count++;
+  qc->bytes += len;
+  pthread_rwlock_unlock(&qc->lock);
+}
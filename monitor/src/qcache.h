@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (qcache.h)
+ *
+ */
+
+#ifndef _QCACHE_H
+#define _QCACHE_H  1
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "globals.h"
+
+// A serialized reply and what it was built from
+typedef struct qcache_entry {
+
+	char    *key;      // normalized query
+	uint64_t gen;      // generation of the data it was built at
+	long    built;     // when, in ms of the monotonic clock
+	char    *reply;    // payload, ready to queue
+	size_t  len;
+	int     flags;     // APPHDR_ flags of how it is encoded
+	struct qcache_entry *next;  // next in the hash chain
+
+} qcentry;
+
+// Replies to application queries, shared by all workers
+typedef struct query_cache {
+
+	pthread_rwlock_t lock;
+	qcentry *buckets[QCACHE_BUCKETS];
+	int     count;     // # of entries
+	size_t  bytes;     // their replies put together
+	int     ttl;       // ms a reply may be served after its data moved on, -1 if off
+	unsigned long hits;
+	unsigned long misses;
+
+} qcache;
+
+int qcache_init(qcache*, int);
+int qcache_enabled(qcache*);
+int qcache_normalize(char*, int, const char*);
+int qcache_get(qcache*, const char*, uint64_t, outqueue*, char*);
+void qcache_put(qcache*, const char*, uint64_t, const char*, size_t, int);
+
+#endif /* _QCACHE_H */
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (rate.c)
+ *
+ */
+
+// Rates of counters that only go up, like the ticks of /proc/stat and the
+// bytes of /proc/net/dev. A table keeps the last value of each counter by
+// name with the CLOCK_MONOTONIC time it was read at, so a rate is over the
+// time that really passed, whatever the interval of the caller, and a
+// counter that went back is told apart from one that wrapped.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "rate.h"
+
+uint64_t
+rate_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+// How far a counter went from was to is, into *delta. Counters are 64 bit,
+// one in the top half of its range that comes back below wrapped around,
+// any other going back was reset (a driver reloaded, an interface made
+// again) and there is no telling how far it went: returns 0.
+int
+rate_diff(uint64_t was, uint64_t is, uint64_t *delta)
+{
+  if (is >= was) {
+    *delta = is - was;
+    return(1);
+  }
+  if (was >= (1ull << 63)) {
+    *delta = is + (UINT64_MAX - was) + 1;
+    return(1);
+  }
+  return(0);
+}
+
+// FNV-1a
+static unsigned int
+hash(const char *name)
+{
+  unsigned int h = 2166136261u;
+
+  for (; *name != '\0'; name++) h = (h ^ (unsigned char) *name) * 16777619u;
+  return(h);
+}
+
+static void
+insert(ratetable *t, int i)
+{
+  unsigned int b = hash(t->counters[i].name) % RATE_BUCKETS;
+
+  while (t->index[b] != 0) b = (b + 1) % RATE_BUCKETS;
+  t->index[b] = i + 1;
+}
+
+// Make room in a full table: drop the counters that were not read for
+// RATE_MAXIDLE seconds (interfaces gone, like the veths of containers),
+// or if there are none the one read longest ago, unless that was now too.
+// The index is built again from what is left.
+static void
+evict(ratetable *t, uint64_t now)
+{
+  uint64_t idle = RATE_MAXIDLE * 1000000000ull;
+  int n = 0, oldest = 0;
+
+  for (int i = 1; i < t->ncounters; i++) {
+    if (t->counters[i].ns < t->counters[oldest].ns) oldest = i;
+  }
+  for (int i = 0; i < t->ncounters; i++) {
+    ratecounter *c = &t->counters[i];
+    if (now - c->ns > idle) continue;
+    if (n != i) t->counters[n] = *c;
+    n++;
+  }
+  if (n == t->ncounters && t->counters[oldest].ns < now) {
+    t->counters[oldest] = t->counters[--n];
+  }
+  if (n == t->ncounters) return;
+
+  t->ncounters = n;
+  memset(t->index, 0, sizeof(t->index));
+  for (int i = 0; i < n; i++) insert(t, i);
+}
+
+// The counter by name, added if it is not there yet. Per cpu and per
+// interface counters make hundreds of them, they are found through an
+// index with open addressing rather than by going through them all.
+static ratecounter *
+lookup(ratetable *t, const char *name, uint64_t now, int *isnew)
+{
+  unsigned int b = hash(name) % RATE_BUCKETS;
+
+  *isnew = 0;
+  for (; t->index[b] != 0; b = (b + 1) % RATE_BUCKETS) {
+    ratecounter *c = &t->counters[t->index[b] - 1];
+    if (strcmp(c->name, name) == 0) return(c);
+  }
+  if (strlen(name) >= RATE_NAMELEN) return(NULL);
+  if (t->ncounters == RATE_MAXCOUNTERS) {
+    evict(t, now);
+    if (t->ncounters == RATE_MAXCOUNTERS) return(NULL);
+    for (b = hash(name) % RATE_BUCKETS; t->index[b] != 0; b = (b + 1) % RATE_BUCKETS);
+  }
+  *isnew = 1;
+  strcpy(t->counters[t->ncounters].name, name);
+  t->index[b] = ++t->ncounters;
+  return(&t->counters[t->ncounters - 1]);
+}
+
+// Record value of counter name as read at now (see rate_now()). Returns 1
+// with how far it went since the last time in *delta and the seconds that
+// took in *seconds, 0 the first time, after a reset and if the table is
+// full of counters that were all read now.
+int
+rate_delta(ratetable *t, const char *name, uint64_t value, uint64_t now, uint64_t *delta, double *seconds)
+{
+  int isnew, ok;
+  ratecounter *c = lookup(t, name, now, &isnew);
+
+  if (c == NULL) return(0);
+  ok = !isnew && now > c->ns && rate_diff(c->value, value, delta);
+  if (ok) *seconds = (now - c->ns) / 1e9;
+  c->value = value;
+  c->ns = now;
+  return(ok);
+}
+
+// The same, as a rate per second into *rate
+int
+rate_per_sec(ratetable *t, const char *name, uint64_t value, uint64_t now, double *rate)
+{
+  uint64_t delta;
+  double seconds;
+
+  if (!rate_delta(t, name, value, now, &delta, &seconds)) return(0);
+  *rate = delta / seconds;
+  return(1);
+}
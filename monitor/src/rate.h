@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (rate.h)
+ *
+ */
+
+#ifndef _RATE_H
+#define _RATE_H  1
+
+#include <stdint.h>
+
+#define RATE_NAMELEN 48       // Longest counter name, like "net.eth0.rx"
+#define RATE_MAXCOUNTERS 2048 // Counters one table follows, like 2 per cpu
+#define RATE_BUCKETS 4096     // Of the index, twice the counters
+#define RATE_MAXIDLE 60       // Seconds a counter not read again is kept once the table is full
+
+// The last value of a counter and when it was read
+typedef struct rate_counter {
+
+	char    name[RATE_NAMELEN];
+	uint64_t value;
+	uint64_t ns;       // CLOCK_MONOTONIC
+
+} ratecounter;
+
+typedef struct rate_table {
+
+	ratecounter counters[RATE_MAXCOUNTERS];
+	int     ncounters;
+	int16_t index[RATE_BUCKETS];   // counter + 1 by hash of its name, 0 if free
+
+} ratetable;
+
+#define RATE_TABLE_INIT { .ncounters = 0 }
+
+uint64_t rate_now(void);
+int rate_diff(uint64_t, uint64_t, uint64_t*);
+int rate_delta(ratetable*, const char*, uint64_t, uint64_t, uint64_t*, double*);
+int rate_per_sec(ratetable*, const char*, uint64_t, uint64_t, double*);
+
+#endif /* _RATE_H */
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (ring.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "globals.h"
+#include "ring.h"
+
+// FNV-1a, with the final mix of murmur3 so names differing only in their
+// last digits still land all over the ring
+static uint32_t
+hash(const char *s)
+{
+  uint32_t h = 2166136261u;
+
+  while (*s) {
+    h ^= (unsigned char) *s++;
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return(h);
+}
+
+static int
+by_hash(const void *a, const void *b)
+{
+  const ringpoint *pa = a, *pb = b;
+
+  if (pa->hash != pb->hash) return(pa->hash < pb->hash ? -1 : 1);
+  return(pa->member - pb->member);
+}
+
+static int
+by_name(const void *a, const void *b)
+{
+  return(strcmp(*(char * const *) a, *(char * const *) b));
+}
+
+static int
+add(ring *r, const char *member, size_t len)
+{
+  char **tmp = realloc(r->members, (r->nmembers + 1) * sizeof(char *));
+
+  if (tmp == NULL) {
+    perror("realloc");
+    return(-1);
+  }
+  r->members = tmp;
+  if ((r->members[r->nmembers] = strndup(member, len)) == NULL) return(-1);
+  r->nmembers++;
+  return(0);
+}
+
+// Lay the points of every member out on the ring
+static int
+build(ring *r)
+{
+  char name[512];
+
+  // Same ring on every host, whatever order the members were listed in
+  qsort(r->members, r->nmembers, sizeof(char *), by_name);
+
+  free(r->points);
+  r->points = NULL;
+  r->npoints = 0;
+  if (r->nmembers == 0) return(0);
+  if ((r->points = malloc(r->nmembers * RING_VNODES * sizeof(ringpoint))) == NULL) {
+    perror("malloc");
+    return(-1);
+  }
+  for (int m = 0; m < r->nmembers; m++) {
+    for (int i = 0; i < RING_VNODES; i++) {
+      snprintf(name, sizeof(name), "%s#%d", r->members[m], i);
+      r->points[r->npoints].hash = hash(name);
+      r->points[r->npoints++].member = m;
+    }
+  }
+  qsort(r->points, r->npoints, sizeof(ringpoint), by_hash);
+  return(0);
+}
+
+int
+ring_init(ring *r, char **members, int n)
+{
+  bzero(r, sizeof(ring));
+  for (int i = 0; i < n; i++) {
+    if (add(r, members[i], strlen(members[i])) < 0) return(-1);
+  }
+  return(build(r));
+}
+
+// Add the members of list, "host:port" separated by commas and/or blanks
+// the way monitor.conf lists its masters
+int
+ring_parse(ring *r, const char *list)
+{
+  while (*list != '\0') {
+    size_t len = strcspn(list, ", \t\n\"'");
+    if (len > 0 && add(r, list, len) < 0) return(-1);
+    list += len;
+    if (*list != '\0') list++;
+  }
+  return(build(r));
+}
+
+// Add the "masters" of a config file like monitor.conf
+int
+ring_load(ring *r, const char *file)
+{
+  char line[1024];
+  FILE *fp;
+
+  if ((fp = fopen(file, "r")) == NULL) {
+    perror(file);
+    return(-1);
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *p = line, *hash = strchr(line, '#');
+    if (hash != NULL) *hash = '\0';
+    while (isspace((unsigned char) *p)) p++;
+    if (strncmp(p, "masters", 7) != 0) continue;
+    p += 7;
+    while (isspace((unsigned char) *p)) p++;
+    if (*p++ != '=') continue;
+    while (isspace((unsigned char) *p)) p++;
+    if (ring_parse(r, p) < 0) {
+      fclose(fp);
+      return(-1);
+    }
+  }
+  fclose(fp);
+  return(r->nmembers > 0 ? 0 : -1);
+}
+
+// The members to send the node key to, in order[], first the one that
+// has it and then the ones to fail over to. Returns how many (up to max).
+int
+ring_order(ring *r, const char *key, int *order, int max)
+{
+  uint32_t h = hash(key);
+  int lo = 0, hi = r->npoints, n = 0;
+
+  // First point at or after h, past the last one is the first again
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (r->points[mid].hash < h) lo = mid + 1;
+    else hi = mid;
+  }
+  for (int i = 0; i < r->npoints && n < max && n < r->nmembers; i++) {
+    int m = r->points[(lo + i) % r->npoints].member;
+    int seen = 0;
+    for (int j = 0; j < n; j++) seen |= (order[j] == m);
+    if (!seen) order[n++] = m;
+  }
+  return(n);
+}
+
+void
+ring_free(ring *r)
+{
+  for (int i = 0; i < r->nmembers; i++) free(r->members[i]);
+  free(r->members);
+  free(r->points);
+  bzero(r, sizeof(ring));
+}
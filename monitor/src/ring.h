@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (ring.h)
+ *
+ */
+
+#ifndef _RING_H
+#define _RING_H  1
+
+#include <stdint.h>
+
+#include "globals.h"
+
+// A point of a member on the ring
+typedef struct ring_point {
+
+	uint32_t hash;
+	int     member;    // index into members
+
+} ringpoint;
+
+// Aggregators sharing the nodes by a consistent hash of their names, so
+// adding or removing one only moves the nodes of the ring next to it
+typedef struct hash_ring {
+
+	char    **members; // "host:port" of each
+	int     nmembers;
+	ringpoint *points; // RING_VNODES of every member, by hash
+	int     npoints;
+
+} ring;
+
+int ring_init(ring*, char**, int);
+int ring_parse(ring*, const char*);
+int ring_load(ring*, const char*);
+int ring_order(ring*, const char*, int*, int);
+void ring_free(ring*);
+
+#endif /* _RING_H */
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (rra.c)
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "history.h"
+#include "rra.h"
+
+static const char *func_names[RRA_NFUNCS] = { "min", "max", "avg", "last" };
+
+// Resolutions of the archives, finest first
+static uint32_t steps[RRA_MAXARCHIVES];
+static uint32_t slots[RRA_MAXARCHIVES];
+static int narchives;
+
+// Directory with one file per node, empty while archiving is off
+static char rradir[1024];
+
+// Archive into dir from now on, creating it if need be. levels is a ','
+// separated list of step:slots, seconds per slot and # of them.
+int
+rra_setup(const char *dir, const char *levels)
+{
+  const char *p = levels;
+  int n = 0;
+
+  while (*p != '\0') {
+    unsigned int step, nslots;
+    int used;
+
+    if (n == RRA_MAXARCHIVES || sscanf(p, "%u:%u%n", &step, &nslots, &used) != 2 ||
+        step == 0 || nslots == 0 || (n > 0 && step <= steps[n-1])) {
+      fprintf(stderr, "Bad archive levels '%s', want ascending step:slots[,step:slots]...\n", levels);
+      return(-1);
+    }
+    steps[n] = step;
+    slots[n] = nslots;
+    n++;
+    p += used;
+    if (*p == ',') p++;
+  }
+  if (n == 0) return(-1);
+  narchives = n;
+
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+    perror(dir);
+    return(-1);
+  }
+  strncpy(rradir, dir, sizeof(rradir)-1);
+  return(0);
+}
+
+int
+rra_enabled(void)
+{
+  return(rradir[0] != '\0');
+}
+
+int
+rra_func_id(const char *name)
+{
+  for (int f = 0; f < RRA_NFUNCS; f++) {
+    if (strcasecmp(func_names[f], name) == 0) return(f);
+  }
+  return(-1);
+}
+
+const char *
+rra_func_name(int f)
+{
+  return(func_names[f]);
+}
+
+// The layout every file has, the mapping of an existing file must match
+static size_t
+layout(rrahdr *hdr)
+{
+  size_t off = RRA_PAGE;
+
+  bzero(hdr, sizeof(rrahdr));
+  strcpy(hdr->magic, RRA_MAGIC);
+  hdr->nmetrics = HISTORY_NMETRICS;
+  hdr->narchives = narchives;
+  hdr->nfuncs = RRA_NFUNCS;
+  for (int m = 0; m < HISTORY_NMETRICS; m++) {
+    strncpy(hdr->metrics[m], history_metric_name(m), RRA_NAMELEN-1);
+  }
+  for (int a = 0; a < narchives; a++) {
+    hdr->archive[a].step = steps[a];
+    hdr->archive[a].nslots = slots[a];
+    hdr->archive[a].offset = off;
+    off += (size_t) slots[a] * (sizeof(uint32_t) + HISTORY_NMETRICS * (sizeof(uint32_t) + RRA_NFUNCS * sizeof(float)));
+    off = (off + RRA_PAGE - 1) & ~((size_t) RRA_PAGE - 1);
+  }
+  return(off);
+}
+
+// Move an archive written with other levels out of the way, so a change
+// of -r starts a new one instead of losing the old
+static int
+set_aside(int fd, const char *path)
+{
+  char old[strlen(path) + 5];
+
+  close(fd);
+  snprintf(old, sizeof(old), "%s.old", path);
+  fprintf(stderr, "%s: archive has a different layout, moved to %s\n", path, old);
+  if (rename(path, old) < 0) {
+    perror(old);
+    return(-1);
+  }
+  return(open(path, O_RDWR | O_CREAT | O_EXCL, 0644));
+}
+
+// Map the archive of a node, creating it on first use
+rrafile *
+rra_open(const char *nodename)
+{
+  char path[sizeof(rradir) + MAX_NODENAME_LEN + 8];
+  struct stat st;
+  rrahdr want, have;
+  rrafile *rf;
+  int fd;
+
+  if (!rra_enabled() || nodename[0] == '\0' || nodename[0] == '.' || strchr(nodename, '/') != NULL)
+    return(NULL);
+
+  size_t size = layout(&want);
+  snprintf(path, sizeof(path), "%s/%s.rra", rradir, nodename);
+  if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+    perror(path);
+    return(NULL);
+  }
+  if (fstat(fd, &st) < 0) {
+    perror(path);
+    close(fd);
+    return(NULL);
+  }
+  if (st.st_size != 0 && (st.st_size != size || pread(fd, &have, sizeof(rrahdr), 0) != sizeof(rrahdr) ||
+                          memcmp(&have, &want, sizeof(rrahdr)) != 0)) {
+    if ((fd = set_aside(fd, path)) < 0) return(NULL);
+    st.st_size = 0;
+  }
+  if (st.st_size == 0 && ftruncate(fd, size) < 0) {
+    perror(path);
+    close(fd);
+    return(NULL);
+  }
+
+  if ((rf = calloc(1, sizeof(rrafile))) == NULL) {
+    close(fd);
+    return(NULL);
+  }
+  rf->size = size;
+  rf->hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (rf->hdr == MAP_FAILED) {
+    perror("mmap");
+    free(rf);
+    return(NULL);
+  }
+
+  if (st.st_size == 0) {
+    memcpy(rf->hdr, &want, sizeof(rrahdr));
+  }
+
+  for (int a = 0; a < narchives; a++) {
+    uint32_t n = want.archive[a].nslots;
+    rf->ts[a] = (uint32_t *) ((char *) rf->hdr + want.archive[a].offset);
+    for (int m = 0; m < HISTORY_NMETRICS; m++) {
+      rf->cnt[a][m] = rf->ts[a] + (size_t) (1 + m * (1 + RRA_NFUNCS)) * n;
+      for (int f = 0; f < RRA_NFUNCS; f++) {
+        rf->val[a][m][f] = (float *) (rf->cnt[a][m] + n) + (size_t) f * n;
+      }
+    }
+  }
+  return(rf);
+}
+
+// Fold a sample into the slot covering its time in every archive, so the
+// rollups of each interval are kept up to date as samples come in and
+// never need a rescan. A metric that is NaN (not reported) is left out of
+// its rollups and count, one never reported in the interval stays NaN.
+void
+rra_add(rrafile *rf, time_t timestamp, float *vals)
+{
+  if (rf == NULL || timestamp <= 0) return;
+
+  for (int a = 0; a < narchives; a++) {
+    uint32_t step = steps[a];
+    uint32_t s = (timestamp / step) % slots[a];
+    uint32_t last = rf->ts[a][s];
+
+    if (last / step > timestamp / step) continue; // Slot already moved on
+
+    int fresh = (last / step < timestamp / step); // First sample of this interval
+    for (int m = 0; m < HISTORY_NMETRICS; m++) {
+      float **v = rf->val[a][m];
+      float x = vals[m];
+      if (fresh) {
+        rf->cnt[a][m][s] = 0;
+        v[RRA_MIN][s] = v[RRA_MAX][s] = v[RRA_AVG][s] = v[RRA_LAST][s] = NAN;
+      }
+      if (isnan(x)) continue;
+      uint32_t n = rf->cnt[a][m][s];
+      if (n == 0) {
+        v[RRA_MIN][s] = v[RRA_MAX][s] = v[RRA_AVG][s] = v[RRA_LAST][s] = x;
+      } else {
+        if (x < v[RRA_MIN][s]) v[RRA_MIN][s] = x;
+        if (x > v[RRA_MAX][s]) v[RRA_MAX][s] = x;
+        v[RRA_AVG][s] += (x - v[RRA_AVG][s]) / (n + 1);
+        if (timestamp >= last) v[RRA_LAST][s] = x;
+      }
+      rf->cnt[a][m][s] = n + 1;
+    }
+    // Readers check the time last, so it goes in once the values are
+    __atomic_store_n(&rf->ts[a][s], (uint32_t) (timestamp > last ? timestamp : last), __ATOMIC_RELEASE);
+  }
+}
+
+// Add rollup func of the slots of the archive with resolution step (or
+// the next coarser one) covering [from, to] to out, like history_query()
+// does. Returns the # of samples, or -1 if no archive is that coarse.
+int
+rra_query(rrafile *rf, int step, int func, time_t from, time_t to, int *metrics, int nmetrics, json_object *out)
+{
+  int a;
+
+  for (a = 0; a < narchives && steps[a] < step; a++);
+  if (a == narchives) return(-1);
+  step = steps[a];
+
+  json_object *times = json_object_new_array();
+  json_object *cols[HISTORY_NMETRICS];
+  int n = 0;
+
+  for (int i = 0; i < nmetrics; i++) cols[i] = json_object_new_array();
+
+  long first = from / step, last = to / step;
+  if (last - first >= slots[a]) first = last - slots[a] + 1;
+
+  for (long t = first; rf != NULL && t <= last; t++) {
+    uint32_t s = t % slots[a];
+    uint32_t ts = __atomic_load_n(&rf->ts[a][s], __ATOMIC_ACQUIRE);
+    if (ts / step != t) continue;
+
+    json_object_array_add(times, json_object_new_int(t * step));
+    for (int i = 0; i < nmetrics; i++) {
+      json_object_array_add(cols[i], history_value(rf->val[a][metrics[i]][func][s]));
+    }
+    n++;
+  }
+
+  json_object_object_add(out, "STEP", json_object_new_int(step));
+  json_object_object_add(out, "FUNC", json_object_new_string(func_names[func]));
+  json_object_object_add(out, "TIMESTAMP", times);
+  for (int i = 0; i < nmetrics; i++) {
+    json_object_object_add(out, history_metric_name(metrics[i]), cols[i]);
+  }
+  return(n);
+}
+
+void
+rra_close(rrafile *rf)
+{
+  if (rf == NULL) return;
+  munmap(rf->hdr, rf->size);
+  free(rf);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (rra.h)
+ *
+ */
+
+#ifndef _RRA_H
+#define _RRA_H  1
+
+#include <stdint.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+
+#define RRA_MAGIC "WWRRA03"
+#define RRA_NAMELEN 16
+#define RRA_PAGE 4096
+
+// Rollups kept of every metric in every slot
+#define RRA_MIN 0
+#define RRA_MAX 1
+#define RRA_AVG 2
+#define RRA_LAST 3
+#define RRA_NFUNCS 4
+
+// Where one archive lives in the file. Its columns follow each other from
+// offset on, each nslots long: uint32 time of the newest sample folded
+// into the slot, then for every metric a uint32 # of its samples folded
+// in (those it was NaN in don't count) and a float column per rollup
+// (min, max, avg, last).
+typedef struct rra_archive_desc {
+
+	uint32_t step;     // seconds per slot
+	uint32_t nslots;
+	uint64_t offset;   // from the start of the file, page aligned
+
+} rradesc;
+
+// First page of every archive file. Readers (Warewulf::Monitor) only need
+// this to find any sample: slot = (time / step) % nslots.
+typedef struct rra_file_header {
+
+	char     magic[8];
+	uint32_t nmetrics;
+	uint32_t narchives;
+	uint32_t nfuncs;
+	uint32_t reserved;
+	char     metrics[HISTORY_NMETRICS][RRA_NAMELEN];
+	rradesc  archive[RRA_MAXARCHIVES];  // narchives of them are used
+
+} rrahdr;
+
+// A node's archive file mapped into the aggregator
+typedef struct rra_file {
+
+	rrahdr   *hdr;     // start of the mapping
+	size_t   size;
+	uint32_t *ts[RRA_MAXARCHIVES];
+	uint32_t *cnt[RRA_MAXARCHIVES][HISTORY_NMETRICS];
+	float    *val[RRA_MAXARCHIVES][HISTORY_NMETRICS][RRA_NFUNCS];
+
+} rrafile;
+
+int rra_setup(const char*, const char*);
+int rra_enabled(void);
+int rra_func_id(const char*);
+const char *rra_func_name(int);
+rrafile *rra_open(const char*);
+void rra_add(rrafile*, time_t, float*);
+int rra_query(rrafile*, int, int, time_t, time_t, int*, int, json_object*);
+void rra_close(rrafile*);
+
+#endif /* _RRA_H */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (sampler.c)
+ *
+ */
+
+// Fast samples of the collector, taken many times between two sends
+// (wwmon_collector -r). Each reads the cpu and network counters and puts
+// their rates since the last one into a ring, nothing else, so it is a
+// pread() and a scan of two files. At the send the rates are summed up as
+// the MIN, MAX, MEAN and LAST of CPUUTIL, NETRECEIVE and NETTRANSMIT, so a
+// spike shorter than the send interval shows where the average of it
+// would not, and the aggregator still gets one sample per node and
+// interval.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sampler.h"
+#include "procscan.h"
+#include "getstats.h"
+#include "rate.h"
+
+#define SAMPLER_MAXIFS 64
+
+static const char *metrics[SAMPLER_METRICS] = { "CPUUTIL", "NETRECEIVE", "NETTRANSMIT" };
+
+void
+sampler_init(sampler *s)
+{
+  procfile stat = PROCFILE_INIT("/proc/stat");
+  procfile netdev = PROCFILE_INIT("/proc/net/dev");
+
+  memset(s, 0, sizeof(sampler));
+  s->stat = stat;
+  s->netdev = netdev;
+}
+
+// Read the counters and put their rates since the last time into the
+// ring, -1 if they could not be read. Like get_net_stats() the rates are
+// taken of every interface on its own and added up, one that comes or
+// goes or is reset doesn't count in between.
+int
+sampler_tick(sampler *s)
+{
+  sampletick *t = &s->ticks[s->head];
+  netif ifs[SAMPLER_MAXIFS];
+  char name[RATE_NAMELEN];
+  uint64_t busy, total, now;
+  double seconds, r, rx = 0, tx = 0;
+  cputicks all;
+  int nifs, first = (s->rates.ncounters == 0);
+
+  if (procfile_read(&s->stat) < 0 || procfile_read(&s->netdev) < 0) return(-1);
+  now = rate_now();
+  if (scan_stat_cpu(s->stat.buf, s->stat.len, &all) < 0) return(-1);
+  nifs = scan_netdev(s->netdev.buf, s->netdev.len, ifs, SAMPLER_MAXIFS);
+
+  t->valid = 0;
+  // user + nice of user + nice + system + idle, like get_cpu_util()
+  int b_ok = rate_delta(&s->rates, "cpu.busy", all.user + all.nice, now, &busy, &seconds);
+  int t_ok = rate_delta(&s->rates, "cpu.total", all.user + all.nice + all.system + all.idle, now, &total, &seconds);
+  if (b_ok && t_ok && total > 0) {
+    t->val[0] = (double) busy * 100 / total;
+    if (t->val[0] > 100) t->val[0] = 100;
+    t->valid |= 1;
+  }
+
+  // KB/s
+  for (int i = 0; i < nifs && i < SAMPLER_MAXIFS; i++) {
+    if (!net_counted(ifs[i].name)) continue;
+    snprintf(name, sizeof(name), "net.%s.rx", ifs[i].name);
+    if (rate_per_sec(&s->rates, name, ifs[i].rx_bytes, now, &r)) rx += r;
+    snprintf(name, sizeof(name), "net.%s.tx", ifs[i].name);
+    if (rate_per_sec(&s->rates, name, ifs[i].tx_bytes, now, &r)) tx += r;
+  }
+  if (!first) {
+    t->val[1] = rx / 1024;
+    t->val[2] = tx / 1024;
+    t->valid |= 2 | 4;
+  }
+
+  s->head = (s->head + 1) % SAMPLER_RING;
+  if (s->count < SAMPLER_RING) s->count++;
+  return(0);
+}
+
+// Add the MIN, MAX, MEAN and LAST of every metric over the ring to jobj,
+// then start over
+void
+sampler_summary(sampler *s, json_object *jobj)
+{
+  double min[SAMPLER_METRICS], max[SAMPLER_METRICS], sum[SAMPLER_METRICS], last[SAMPLER_METRICS];
+  int n[SAMPLER_METRICS];
+  int first = (s->head - s->count + SAMPLER_RING) % SAMPLER_RING;
+  char key[MAX_NODENAME_LEN];
+
+  memset(n, 0, sizeof(n));
+  for (int i = 0; i < s->count; i++) {
+    sampletick *t = &s->ticks[(first + i) % SAMPLER_RING];
+    for (int m = 0; m < SAMPLER_METRICS; m++) {
+      double v = t->val[m];
+      if (!(t->valid & (1 << m))) continue;
+      if (n[m] == 0 || v < min[m]) min[m] = v;
+      if (n[m] == 0 || v > max[m]) max[m] = v;
+      sum[m] = (n[m] == 0) ? v : sum[m] + v;
+      last[m] = v;
+      n[m]++;
+    }
+  }
+
+  for (int m = 0; m < SAMPLER_METRICS; m++) {
+    if (n[m] == 0) continue;
+    snprintf(key, sizeof(key), "%s_MIN", metrics[m]);
+    json_object_object_add(jobj, key, json_object_new_int((int) (min[m] + 0.5)));
+    snprintf(key, sizeof(key), "%s_MAX", metrics[m]);
+    json_object_object_add(jobj, key, json_object_new_int((int) (max[m] + 0.5)));
+    snprintf(key, sizeof(key), "%s_MEAN", metrics[m]);
+    json_object_object_add(jobj, key, json_object_new_int((int) (sum[m] / n[m] + 0.5)));
+    snprintf(key, sizeof(key), "%s_LAST", metrics[m]);
+    json_object_object_add(jobj, key, json_object_new_int((int) (last[m] + 0.5)));
+  }
+
+  s->count = 0;
+}
+
+void
+sampler_free(sampler *s)
+{
+  procfile_free(&s->stat);
+  procfile_free(&s->netdev);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (sampler.h)
+ *
+ */
+
+#ifndef _SAMPLER_H
+#define _SAMPLER_H  1
+
+#include <stdint.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "procfile.h"
+#include "rate.h"
+
+#define SAMPLER_METRICS 3  // CPUUTIL, NETRECEIVE, NETTRANSMIT
+
+// The rates one fast sample found since the one before
+typedef struct sample_tick {
+
+	double  val[SAMPLER_METRICS];  // %, KB/s, KB/s
+	int     valid;                 // bit m set if val[m] is
+
+} sampletick;
+
+typedef struct sampler {
+
+	sampletick ticks[SAMPLER_RING];
+	int     head;      // where the next one goes
+	int     count;     // in the ring
+	procfile stat;
+	procfile netdev;
+	ratetable rates;   // the counters the rates are of
+
+} sampler;
+
+void sampler_init(sampler*);
+int sampler_tick(sampler*);
+void sampler_summary(sampler*, json_object*);
+void sampler_free(sampler*);
+
+#endif /* _SAMPLER_H */
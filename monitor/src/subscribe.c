@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (subscribe.c)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "filter.h"
+#include "nodetable.h"
+#include "subscribe.h"
+
+// FNV-1a, like the node table
+static unsigned int
+hash_name(const char *s)
+{
+  unsigned int h = 2166136261u;
+
+  while (*s) {
+    h ^= (unsigned char) *s++;
+    h *= 16777619u;
+  }
+  return(h);
+}
+
+// A subscription to the nodes passing the "filter" and "nodes" of req,
+// pushed every "interval" seconds (default SUBSCRIBE_TICK) they changed.
+// Returns NULL with a message in err if the filter doesn't make sense.
+subscription *
+subscribe_new(json_object *req, char *err, int errlen)
+{
+  subscription *s = calloc(1, sizeof(subscription));
+  json_object *val;
+
+  if (s == NULL || (s->buckets = calloc(SUBSCRIBE_MINSIZE, sizeof(subnode *))) == NULL) {
+    snprintf(err, errlen, "out of memory");
+    free(s);
+    return(NULL);
+  }
+  s->nbuckets = SUBSCRIBE_MINSIZE;
+
+  s->f = filter_compile(json_object_get_string(json_object_object_get(req, "filter")),
+                        json_object_get_string(json_object_object_get(req, "nodes")), err, errlen);
+  if (s->f == NULL) {
+    subscribe_free(s);
+    return(NULL);
+  }
+
+  s->interval = SUBSCRIBE_TICK;
+  if ((val = json_object_object_get(req, "interval")) != NULL && json_object_get_int(val) > 0)
+    s->interval = json_object_get_int(val);
+  return(s);
+}
+
+static subnode *
+find(subscription *s, const char *nodename)
+{
+  subnode *n = s->buckets[hash_name(nodename) & (s->nbuckets - 1)];
+
+  while (n != NULL && strcmp(n->nodename, nodename) != 0) n = n->next;
+  return(n);
+}
+
+// Double the # of buckets, the node table grows the same way
+static void
+grow(subscription *s)
+{
+  int newsize = s->nbuckets * 2;
+  subnode **tmp = calloc(newsize, sizeof(subnode *));
+
+  if (tmp == NULL) return;
+
+  for (int i = 0; i < s->nbuckets; i++) {
+    subnode *n = s->buckets[i];
+    while (n != NULL) {
+      subnode *next = n->next;
+      unsigned int b = hash_name(n->nodename) & (newsize - 1);
+      n->next = tmp[b];
+      tmp[b] = n;
+      n = next;
+    }
+  }
+  free(s->buckets);
+  s->buckets = tmp;
+  s->nbuckets = newsize;
+}
+
+static subnode *
+add(subscription *s, const char *nodename)
+{
+  subnode *n = calloc(1, sizeof(subnode));
+
+  if (n == NULL) return(NULL);
+  strncpy(n->nodename, nodename, MAX_NODENAME_LEN-1);
+  if (s->count >= s->nbuckets) grow(s);
+  unsigned int b = hash_name(nodename) & (s->nbuckets - 1);
+  n->next = s->buckets[b];
+  s->buckets[b] = n;
+  s->count++;
+  return(n);
+}
+
+// Called by nodetable_walk() for every node passing the filter, with the
+// node table locked, so only what changed is copied out
+static void
+collect(void *arg, nodeent *e)
+{
+  subscription *s = (subscription *) arg;
+  subnode *n;
+
+  if ((n = find(s, e->nodename)) == NULL && (n = add(s, e->nodename)) == NULL) return;
+  n->seen = s->mark;
+  if (n->blob != NULL && n->gen == e->gen) return;
+
+  if (s->nchanges == s->maxchanges) {
+    int newmax = s->maxchanges ? s->maxchanges * 2 : SUBSCRIBE_MINSIZE;
+    subchange *tmp = realloc(s->changes, newmax * sizeof(subchange));
+    if (tmp == NULL) return; // Sent next time
+    s->changes = tmp;
+    s->maxchanges = newmax;
+  }
+  if ((s->changes[s->nchanges].blob = strdup(e->blob)) == NULL) return;
+  s->changes[s->nchanges++].node = n;
+  n->gen = e->gen;
+}
+
+// The keys of blob that old lacks or has another value for, as a JSON
+// string. All of blob if there is no old, NULL if nothing differs.
+static json_object *
+diff(const char *old, const char *blob)
+{
+  json_object *was = (old != NULL) ? json_tokener_parse(old) : NULL;
+  json_object *now = json_tokener_parse(blob);
+  json_object *changed, *str;
+
+  if (now == NULL) {
+    if (was != NULL) json_object_put(was);
+    return(NULL);
+  }
+  if (was == NULL) {
+    json_object_put(now);
+    return(json_object_new_string(blob));
+  }
+
+  int n = 0;
+  changed = json_object_new_object();
+  json_object_object_foreach(now, key, value) {
+    json_object *before = json_object_object_get(was, key);
+    if (before != NULL && value != NULL &&
+        strcmp(json_object_to_json_string(before), json_object_to_json_string(value)) == 0) continue;
+    json_object_object_add(changed, key, value != NULL ? json_object_get(value) : NULL);
+    n++;
+  }
+  str = (n > 0) ? json_object_new_string(json_object_to_json_string(changed)) : NULL;
+  json_object_put(changed);
+  json_object_put(was);
+  json_object_put(now);
+  return(str);
+}
+
+static void
+drop(subscription *s, subnode **pn)
+{
+  subnode *n = *pn;
+
+  *pn = n->next;
+  free(n->blob);
+  free(n);
+  s->count--;
+}
+
+// Add to out what changed of the subscribed nodes since the last push, if
+// the next one is due by now (or at once if force): nodes new to the
+// subscriber in full, others only with the keys that changed, and the
+// names of nodes that no longer pass the filter in "DROPPED". The first
+// push has "SNAPSHOT" set. Returns the # of nodes changed or dropped, 0
+// if there is nothing to send.
+int
+subscribe_push(subscription *s, nodetable *nt, time_t now, int force, json_object *out)
+{
+  json_object *dropped = NULL;
+  int n = 0, ndropped = 0;
+
+  if (!force && now < s->due) return(0);
+  s->due = now + s->interval;
+
+  // Taken first, a change while walking shows as a newer generation
+  uint64_t gen = nodetable_gen(nt);
+  if (!force && s->mark > 0 && gen == s->gen) return(0);
+  s->gen = gen;
+
+  if (s->mark == 0) json_object_object_add(out, "SNAPSHOT", json_object_new_int(1));
+  s->mark++;
+  s->nchanges = 0;
+  nodetable_walk(nt, s->f, collect, s);
+
+  for (int i = 0; i < s->nchanges; i++) {
+    subnode *node = s->changes[i].node;
+    json_object *str = diff(node->blob, s->changes[i].blob);
+    free(node->blob);
+    node->blob = s->changes[i].blob;
+    if (str == NULL) continue;
+    json_object_object_add(out, node->nodename, str);
+    n++;
+  }
+
+  for (int i = 0; i < s->nbuckets; i++) {
+    subnode **pn = &s->buckets[i];
+    while (*pn != NULL) {
+      if ((*pn)->seen == s->mark) {
+        pn = &(*pn)->next;
+        continue;
+      }
+      if (dropped == NULL) dropped = json_object_new_array();
+      json_object_array_add(dropped, json_object_new_string((*pn)->nodename));
+      drop(s, pn);
+      ndropped++;
+    }
+  }
+  if (dropped != NULL) json_object_object_add(out, "DROPPED", dropped);
+
+  json_object_object_add(out, "JSON_CT", json_object_new_int(n));
+  return(n + ndropped);
+}
+
+void
+subscribe_free(subscription *s)
+{
+  if (s == NULL) return;
+  if (s->buckets != NULL) {
+    for (int i = 0; i < s->nbuckets; i++) {
+      while (s->buckets[i] != NULL) drop(s, &s->buckets[i]);
+    }
+  }
+  free(s->buckets);
+  free(s->changes);
+  filter_free(s->f);
+  free(s);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (subscribe.h)
+ *
+ */
+
+#ifndef _SUBSCRIBE_H
+#define _SUBSCRIBE_H  1
+
+#include <stdint.h>
+#include <time.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "filter.h"
+#include "nodetable.h"
+
+#define SUBSCRIBE_MINSIZE 64  // Initial # of buckets for the nodes of a subscriber
+
+// What a subscriber was last sent of one node
+typedef struct subscribed_node {
+
+	char    nodename[MAX_NODENAME_LEN];
+	uint64_t gen;      // generation of the node when sent
+	char    *blob;     // all it had then, the next push only has what differs
+	int     seen;      // mark of the last walk the node passed the filter in
+	struct subscribed_node *next;  // next in the hash chain
+
+} subnode;
+
+// A node that changed since the last push, its blob taken while walking
+// the table and compared once the table is unlocked again
+typedef struct subscribed_change {
+
+	subnode *node;
+	char    *blob;
+
+} subchange;
+
+typedef struct subscription {
+
+	filter  *f;
+	int     interval;  // seconds between pushes
+	time_t  due;       // of the next push
+	uint64_t gen;      // generation of the node table at the last push
+	int     mark;      // # of walks so far
+
+	subnode **buckets;
+	int     nbuckets;  // always a power of 2
+	int     count;     // # of nodes sent
+
+	subchange *changes;  // found by the current walk
+	int     nchanges;
+	int     maxchanges;
+
+} subscription;
+
+subscription *subscribe_new(json_object*, char*, int);
+int subscribe_push(subscription*, nodetable*, time_t, int, json_object*);
+void subscribe_free(subscription*);
+
+#endif /* _SUBSCRIBE_H */
@@ -28,9 +28,15 @@
 #include <json/json.h>
 #include <sqlite3.h>
 #include <sys/utsname.h>
+#include <poll.h>
 
 #include "globals.h"
 #include "util.h"
+#include "compress.h"
+#include "procfile.h"
+#include "procscan.h"
+
+#define PARSER_BUFSIZE 16384  // Of the files fast_data_parser() reads
 
 /* Any forward declarations */
 static int
@@ -345,44 +351,167 @@ NodeTS_fromDB(char *nodename, sqlite3 *db)
   return(timestamp);
 }
 
-char *
-recvall(int sock)
+// Where the next bytes of the frame go and how many we still want
+static char *
+frame_dest(framedec *d, int *want)
 {
-  int count, r_payloadlen;
+  if (d->state == FRAME_HDR) {
+    *want = sizeof(apphdr) - d->hdr_got;
+    return((char *) &d->hdr + d->hdr_got);
+  }
+  *want = d->hdr.len - d->got;
+  if (*want > d->size - 1 - d->got) *want = d->size - 1 - d->got;
+  return(d->buf + d->got);
+}
 
-  char *rbuf = malloc(MAXPKTSIZE);
+// Make room for at least size bytes in buf, keeping what it holds
+static int
+frame_grow(framedec *d, int size)
+{
+  char *tmp;
 
-  apphdr *app_h = (apphdr *) rbuf;
-  appdata *app_d = (appdata *) (rbuf + sizeof(apphdr));
+  if (d->size >= size) return(0);
+  if ((tmp = realloc(d->buf, size)) == NULL) {
+    perror("realloc");
+    return(-1);
+  }
+  d->buf = tmp;
+  d->size = size;
+  return(0);
+}
+
+// A length of MAXFRAMELEN must not run into the flags
+_Static_assert(MAXFRAMELEN < APPHDR_LZ4, "MAXFRAMELEN overlaps the APPHDR_ flags");
+
+// Account for n bytes just placed at frame_dest()
+static int
+frame_advance(framedec *d, int n)
+{
+  if (d->state == FRAME_HDR) {
+    d->hdr_got += n;
+    if (d->hdr_got < sizeof(apphdr)) return(FRAME_MORE);
+
+    d->flags = d->hdr.len & APPHDR_FLAGS;
+    d->hdr.len &= ~APPHDR_FLAGS;
+    if (d->hdr.len < 0 || d->hdr.len > MAXFRAMELEN) {
+      fprintf(stderr, "Bad frame length %d\n", d->hdr.len);
+      return(FRAME_ERROR);
+    }
+    // Size the buffer for the payload plus the NULL char, but only up to
+    // FRAME_PREALLOC: any peer can send a header claiming MAXFRAMELEN
+    int size = (d->hdr.len < FRAME_PREALLOC) ? d->hdr.len + 1 : FRAME_PREALLOC + 1;
+    if (frame_grow(d, size) < 0) return(FRAME_ERROR);
+    d->got = 0;
+    d->state = FRAME_PAYLOAD;
+  } else {
+    d->got += n;
+  }
 
-  //block to receive the whole header
-  if ((count=recv(sock, rbuf, sizeof(apphdr), MSG_WAITALL)) == -1) {
-    perror("recv");
-    exit(1);
+  // Full but more to come, twice the room up to what is left of it
+  if (d->got < d->hdr.len && d->got == d->size - 1) {
+    int size = (d->hdr.len - d->got < d->size) ? d->hdr.len + 1 : 2 * d->size - 1;
+    if (frame_grow(d, size) < 0) return(FRAME_ERROR);
   }
-  //printf("app_h->len: %d\n", app_h->len);
-  //printf("Received - %s\n",app_d->payload);
 
-  char *buffer;
-  // plus 1 to store the NULL char
-  buffer = (char *) malloc (app_h->len+1);
-  buffer[0] = '\0';
+  if (d->got < d->hdr.len) return(FRAME_MORE);
+  d->buf[d->got] = '\0';
+  return(FRAME_DONE);
+}
 
-  r_payloadlen = app_h->len;
+// Get ready for the next frame, keeping a buffer of reasonable size
+void
+frame_reset(framedec *d)
+{
+  if (d->size > MAXPKTSIZE) {
+    free(d->buf);
+    d->buf = NULL;
+    d->size = 0;
+  }
+  d->state = FRAME_HDR;
+  d->hdr_got = 0;
+  d->got = 0;
+}
+
+// Hand the payload of a complete frame over to the caller
+char *
+frame_take(framedec *d)
+{
+  char *buf = d->buf;
+  d->buf = NULL;
+  d->size = 0;
+  frame_reset(d);
+  return(buf);
+}
+
+void
+frame_free(framedec *d)
+{
+  free(d->buf);
+  bzero(d, sizeof(framedec));
+}
+
+// Decode from memory. *used is set to the # of bytes of data consumed,
+// anything past a complete frame belongs to the next one.
+int
+frame_feed(framedec *d, const char *data, int len, int *used)
+{
+  int want, n, rc = FRAME_MORE;
+  char *dest;
+
+  *used = 0;
+  while (*used < len) {
+    dest = frame_dest(d, &want);
+    n = (len - *used < want) ? len - *used : want;
+    memcpy(dest, data + *used, n);
+    *used += n;
+    if ((rc = frame_advance(d, n)) != FRAME_MORE) break;
+  }
+  return(rc);
+}
 
-  int numtoread = MAXPKTSIZE-1;
-  while(r_payloadlen > 0){
-    if(r_payloadlen < MAXPKTSIZE-1) numtoread = r_payloadlen;
-    if((count = recv(sock, rbuf, numtoread,0)) == -1){
+// Decode straight from a socket. Each recv asks for no more than the
+// current frame still needs, so nothing of the next frame is consumed.
+// On a non-blocking socket FRAME_MORE means try again when readable.
+int
+frame_recv(int sock, framedec *d)
+{
+  int want, n, rc;
+  char *dest;
+
+  while (1) {
+    dest = frame_dest(d, &want);
+    if ((n = recv(sock, dest, want, 0)) == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return(FRAME_MORE);
       perror("recv");
-      exit(1);
+      return(FRAME_ERROR);
     }
-    rbuf[count] = '\0';
-    strcat(buffer, rbuf);
-    r_payloadlen -= count;
+    if (n == 0) return(FRAME_CLOSED);
+    if ((rc = frame_advance(d, n)) != FRAME_MORE) return(rc);
   }
-  free(rbuf);
-  return buffer;
+}
+
+char *
+recvall(int sock)
+{
+  framedec d;
+  int rc;
+
+  bzero(&d, sizeof(d));
+  //block to receive the whole frame
+  if ((rc = frame_recv(sock, &d)) != FRAME_DONE) {
+    frame_free(&d);
+    return(NULL);
+  }
+  if (d.flags & APPHDR_COMPRESS) {
+    // Only sent to peers that asked for it at registration
+    size_t len;
+    char *buf = decompress_frame(d.flags, d.buf, d.got, &len);
+    if (buf == NULL) fprintf(stderr, "Not able to decompress the reply\n");
+    frame_free(&d);
+    return(buf);
+  }
+  return(frame_take(&d));
 }
 
 // To Handle any partial sends
@@ -395,6 +524,13 @@ sendall(int s, char *buf, int total)
 
   while( sendbytes < total) {
         if( (n = send(s, buf+sendbytes, bytesleft, MSG_NOSIGNAL)) == -1) {
+          if( errno == EINTR ) continue;
+          if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+            // Non-blocking socket with a full send buffer, wait till it drains
+            struct pollfd pfd = { s, POLLOUT, 0 };
+            poll(&pfd, 1, -1);
+            continue;
+          }
           perror("send");
           break;
         }
@@ -404,6 +540,40 @@ sendall(int s, char *buf, int total)
   return n==-1? errno: 0;
 }
 
+// A payload with the APPHDR_ flags of how it is encoded, header and all
+// in one send() so on a UDP socket it is one datagram
+int
+send_frame(int sock, const char *payload, size_t len, int flags)
+{
+  struct utsname unameinfo;
+  apphdr *app_h;
+  char *buf;
+  int rval = 0;
+
+  if (len > MAXFRAMELEN) {
+    fprintf(stderr, "Frame of %zu bytes is too big to send\n", len);
+    return(-1);
+  }
+  if ((buf = malloc(sizeof(apphdr) + len)) == NULL) {
+    perror("malloc");
+    return(-1);
+  }
+  uname(&unameinfo);
+  app_h = (apphdr *) buf;
+  bzero(app_h, sizeof(apphdr));
+  app_h->len = len | flags;
+  app_h->timestamp = time(NULL);
+  strncpy(app_h->nodename, unameinfo.nodename, MAX_NODENAME_LEN-1);
+  memcpy(buf + sizeof(apphdr), payload, len);
+
+  if (send(sock, buf, sizeof(apphdr) + len, MSG_NOSIGNAL) < 0) {
+    rval = errno;
+    perror("send");
+  }
+  free(buf);
+  return(rval);
+}
+
 int
 send_json(int sock, json_object *jobj)
 {
@@ -419,7 +589,13 @@ send_json(int sock, json_object *jobj)
   int  json_len, bytes_left, buffer_len, bytestocopy, bytes_read;
   char *json_str;
 
-  json_len = (int) strlen(json_object_to_json_string(jobj)); // plus 1 for NULL char
+  size_t full_len = strlen(json_object_to_json_string(jobj));
+  if (full_len > MAXFRAMELEN) {
+    fprintf(stderr, "Frame of %zu bytes is too big to send\n", full_len);
+    free(buffer);
+    return(EMSGSIZE);
+  }
+  json_len = (int) full_len; // plus 1 for NULL char
   json_str = (char *) malloc(json_len+1);
   strcpy(json_str, json_object_to_json_string(jobj));
 
@@ -465,6 +641,117 @@ send_json(int sock, json_object *jobj)
   return rval;
 }
 
+int
+outq_append(outqueue *q, const void *data, size_t len)
+{
+  if (q->off == q->len) {
+    q->off = q->len = 0;
+  }
+
+  if (q->len + len > q->size) {
+    // Reclaim what has been sent already before growing
+    if (q->off > 0) {
+      memmove(q->buf, q->buf + q->off, q->len - q->off);
+      q->len -= q->off;
+      q->off = 0;
+    }
+    if (q->len + len > q->size) {
+      size_t newsize = q->size ? q->size : MAXPKTSIZE;
+      while (newsize < q->len + len) newsize *= 2;
+      char *tmp = realloc(q->buf, newsize);
+      if (tmp == NULL) {
+        perror("realloc");
+        return(-1);
+      }
+      q->buf = tmp;
+      q->size = newsize;
+    }
+  }
+
+  memcpy(q->buf + q->len, data, len);
+  q->len += len;
+  return(0);
+}
+
+// Queue a json_object as one frame, the same as send_json() puts on the wire
+int
+outq_add_json(outqueue *q, json_object *jobj, char *nodename)
+{
+  const char *json_str = json_object_to_json_string(jobj);
+
+  return(outq_add_string(q, json_str, strlen(json_str), nodename));
+}
+
+// Queue a payload already serialized, like a reply kept in the cache
+int
+outq_add_string(outqueue *q, const char *json_str, size_t len, char *nodename)
+{
+  return(outq_add_frame(q, json_str, len, 0, nodename));
+}
+
+// Queue a payload with the APPHDR_ flags of how it is encoded
+int
+outq_add_frame(outqueue *q, const char *payload, size_t len, int flags, char *nodename)
+{
+  apphdr app_h;
+
+  if (len > MAXFRAMELEN) {
+    fprintf(stderr, "Frame of %zu bytes is too big to send\n", len);
+    return(-1);
+  }
+  bzero(&app_h, sizeof(app_h));
+  app_h.len = len | flags;
+  app_h.timestamp = time(NULL);
+  strncpy(app_h.nodename, nodename, MAX_NODENAME_LEN-1);
+
+  if (outq_append(q, &app_h, sizeof(app_h)) < 0 ||
+      outq_append(q, payload, len) < 0) {
+    return(-1);
+  }
+  return(0);
+}
+
+size_t
+outq_pending(outqueue *q)
+{
+  return(q->len - q->off);
+}
+
+// Send as much of the queue as the socket takes without blocking.
+// Returns the # of bytes still queued or -1 if the socket failed.
+int
+outq_flush(int sock, outqueue *q)
+{
+  int n;
+
+  while (q->off < q->len) {
+    if ((n = send(sock, q->buf + q->off, q->len - q->off,
+                  MSG_NOSIGNAL | MSG_DONTWAIT)) == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      perror("send");
+      return(-1);
+    }
+    q->off += n;
+  }
+
+  if (q->off == q->len) {
+    q->off = q->len = 0;
+    // Don't hang on to the memory of an unusually large response
+    if (q->size > OUTQ_LOWWATER) {
+      outq_free(q);
+    }
+  }
+  return(q->len - q->off);
+}
+
+void
+outq_free(outqueue *q)
+{
+  free(q->buf);
+  bzero(q, sizeof(outqueue));
+}
+
 void
 array_list_print(array_list *ls)
 {
@@ -521,73 +808,62 @@ More efficient version of file_parser. Instead of accessing a file
 number of keys times, opens a file only once and collects
 data as it parses. Upon successful location of the key and value,
 function places kv-pair in json_object whose pointer is the return
-value.
+value. The file is read into a buffer on the stack and each line
+matched against the keys where it is, nothing is allocated but the
+JSON. Lines are "key: value", like /proc/meminfo and /proc/cpuinfo.
 */
 json_object *fast_data_parser(char *file_name, array_list *keys, int num_keys){
-  FILE *fp;
+  char buf[PARSER_BUFSIZE];
+  int fd, i, keys_found = 0;
+  ssize_t len = 0, n;
+
+  if((fd = open(file_name, O_RDONLY)) < 0){
+    printf("I/O ERROR: could not access file\n");
+    return NULL;
+  }
+  while(len < sizeof(buf) && (n = read(fd, buf + len, sizeof(buf) - len)) > 0) len += n;
+  close(fd);
+
   json_object *jobj = json_object_new_object();
-  int i, keys_found = 0;
-  if(fp = fopen(file_name, "r")){
-    char *line = malloc(sizeof(char)*100);
-    char *data = malloc(sizeof(char)*100);
-    while(fgets(line, 100,fp)){
-      for(i = 0; i < num_keys; i++){
-	if(data = strstr(line, array_list_get_idx(keys, i))){
-	  while(*data != ':') data++;
-	  while(isspace(*data) || ispunct(*data)) data ++;
-	  json_object_object_add(jobj, array_list_get_idx(keys, i), (json_object *) json_object_new_string(chop(data)));
-	  keys_found += 1;
-	  if(keys_found == num_keys) break; 
-	}
+  const char *p = buf, *end = buf + len;
+  while(p < end && keys_found < num_keys){
+    const char *nl = memchr(p, '\n', end - p);
+    const char *eol = nl ? nl : end;
+    for(i = 0; i < num_keys; i++){
+      const char *key = array_list_get_idx(keys, i);
+      size_t klen = strlen(key);
+      if(eol - p >= klen && memcmp(p, key, klen) == 0){
+        const char *data = p + klen;
+        while(data < eol && *data != ':') data++;
+        while(data < eol && (isspace(*data) || ispunct(*data))) data++;
+        const char *last = eol;
+        while(last > data && isspace(last[-1])) last--;
+        json_object_object_add(jobj, key, json_object_new_string_len(data, last - data));
+        keys_found += 1;
+        break;
       }
     }
-    free(line);
-    free(data);
-    fclose(fp);
-    return jobj;
-  } else {
-    printf("I/O ERROR: could not access file\n");
-    return NULL;
+    p = eol + 1;
   }
+  return jobj;
 }
 
 long
 get_jiffs(cpu_data *cd)
 {
-  long total_jiffs, work_jiffs;
-  int i=0;
-  total_jiffs = 0;
-  work_jiffs = 0;
-  FILE *fp;
-  if(fp = fopen("/proc/stat", "r")){
-    char *line = malloc(sizeof(char)*100);
-    char *data = malloc(sizeof(char)*100);
-    while(fgets(line, 100, fp)){
-      if(data = strstr(line, "cpu")){
-	char * result = NULL;
-	result = strtok(data, " ");
-	while(result != NULL){
-	  chop(result);
-	  if(strcmp("cpu", result)){
-	    if(i++ < 3) work_jiffs += atoi(result); // calculating work_jiffs
-	    total_jiffs += atoi(result); // calculating total_jiffs
-	  }
-	  result = strtok(NULL, " ");
-	}
-      }
-      i = 0; // reset i to get each cpu's work_jiffs added
-    }
-    free(line);
-    free(data);
-    fclose(fp);
-    cd->tj = total_jiffs;
-    cd->wj = work_jiffs;
+  static procfile stat_f = PROCFILE_INIT("/proc/stat");
+  cputicks all;
 
-    return 0;
-  } else {
+  if(procfile_read(&stat_f) < 0){
     printf("I/O ERROR: could not access file\n");
     return -1;
   }
+  bzero(&all, sizeof(all));
+  scan_stat_cpu(stat_f.buf, stat_f.len, &all);
+  cd->wj = all.user + all.nice + all.system; // calculating work_jiffs
+  cd->tj = cd->wj + all.idle + all.iowait + all.irq + all.softirq + all.steal; // calculating total_jiffs
+
+  return 0;
 }
 
 /*
@@ -642,10 +918,13 @@ get_string_from_json(json_object *jobj, char *kname, char *str) {
 }
 
 int
-registerConntype(int sock, int type) {
+registerConntype(int sock, int type, const char *encoding) {
   json_object *jobj;
   jobj = json_object_new_object();
   json_object_object_add(jobj, "CONN_TYPE", json_object_new_int(type));
+  // Asked for, the reply says if the aggregator speaks it (see wire.c)
+  if (encoding != NULL)
+    json_object_object_add(jobj, "ENCODING", json_object_new_string(encoding));
  
   send_json(sock, jobj);
   json_object_put(jobj);
@@ -654,13 +933,26 @@ registerConntype(int sock, int type) {
 }
 
 int
-setup_ConnectSocket(char *hostname, int port) {
+set_nonblocking(int sock) {
+  int flags;
+
+  if ((flags = fcntl(sock, F_GETFL, 0)) < 0 ||
+      fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+    perror("fcntl");
+    return(-1);
+  }
+  return(0);
+}
+
+// A socket of type (SOCK_STREAM or SOCK_DGRAM) connected to hostname:port
+static int
+connectTo(char *hostname, int port, int type) {
  
   int sock;
   struct sockaddr_in server_addr;
   struct hostent *host;
 
-  if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+  if ((sock = socket(AF_INET, type, 0)) == -1)
   {
     perror("socket");
     return(-1);
@@ -668,6 +960,7 @@ setup_ConnectSocket(char *hostname, int port) {
 
   if ((host=gethostbyname(hostname)) == NULL) {  // get the host info
       perror("gethostbyname");
+      close(sock);
       return(-1);
   }
 
@@ -678,12 +971,24 @@ setup_ConnectSocket(char *hostname, int port) {
 
   if (connect(sock, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1) {
       perror("connect");
+      close(sock);
       return(-1);
   }
 
   return(sock);
 }
 
+int
+setup_ConnectSocket(char *hostname, int port) {
+  return(connectTo(hostname, port, SOCK_STREAM));
+}
+
+// For sending datagrams to the aggregator, one sample each
+int
+setup_ConnectUDP(char *hostname, int port) {
+  return(connectTo(hostname, port, SOCK_DGRAM));
+}
+
 int 
 createTable(sqlite3 *db, char *tName) 
 {
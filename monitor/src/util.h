@@ -23,15 +23,30 @@
 /* Yup... function declarations... */
 void insertLookups(int, json_object*, sqlite3*);
 void updateLookups(int, json_object*, sqlite3*);
+void update_insertLookups(int, json_object*, sqlite3*, int);
 void fillLookups(int, json_object*, sqlite3*);
 void insert_json(char*, time_t, json_object*, sqlite3*);
 void update_json(char*, time_t, json_object*, sqlite3*, int);
 void insert_update_json(int, char*, time_t, json_object*, sqlite3*);
+void merge_json(char*, time_t, json_object*, sqlite3*, int);
 int NodeBID_fromDB(char*, sqlite3*);
 int NodeTS_fromDB(char*, sqlite3*);
 char* recvall(int);
+int frame_recv(int, framedec*);
+int frame_feed(framedec*, const char*, int, int*);
+void frame_reset(framedec*);
+char* frame_take(framedec*);
+void frame_free(framedec*);
 int sendall(int, char*, int);
+int send_frame(int, const char*, size_t, int);
 int send_json(int, json_object*);
+int outq_append(outqueue*, const void*, size_t);
+int outq_add_json(outqueue*, json_object*, char*);
+int outq_add_string(outqueue*, const char*, size_t, char*);
+int outq_add_frame(outqueue*, const char*, size_t, int, char*);
+size_t outq_pending(outqueue*);
+int outq_flush(int, outqueue*);
+void outq_free(outqueue*);
 void array_list_print(array_list*);
 void json_parse_complete(json_object*);
 void json_parse(json_object*);
@@ -49,8 +64,10 @@ int get_int_from_json(json_object*, char*);
 void get_string_from_json(json_object*, char*, char*);
 
 /* Connection Functions */
-int registerConntype(int, int);
+int registerConntype(int, int, const char*);
 int setup_ConnectSocket(char*, int);
+int setup_ConnectUDP(char*, int);
+int set_nonblocking(int);
 
 /* SQLite Functions */
 int createTable(sqlite3*, char*);
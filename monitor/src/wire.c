@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (wire.c)
+ *
+ */
+
+// The binary encoding a peer may ask for instead of JSON, by adding
+// "ENCODING": WIRE_ENCODING to its CONN_TYPE registration. An aggregator
+// that knows it says so in its reply, along with "KEYS", the names of the
+// keys ids 1, 2, ... stand for. Frames so encoded have APPHDR_BINARY set
+// in apphdr.len and hold a version byte and then one value:
+//
+//   value  = type byte, then by type
+//            WIRE_INT     zigzag varint
+//            WIRE_DOUBLE  8 bytes, little endian
+//            WIRE_STRING  varint length, the bytes
+//            WIRE_OBJECT  varint count, count times a key and a value
+//            WIRE_ARRAY   varint count, count values
+//   key    = varint id, or 0, varint length and the name, which takes the
+//            next id on both ends from then on (till WIRE_MAXKEYS)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/utsname.h>
+#include <json/json.h>
+
+#include "globals.h"
+#include "util.h"
+#include "wire.h"
+
+#define WIRE_MAXNAME 256  // Longest key name we take
+
+// What every collector sends, in the order of their ids
+static const char *builtin[] = {
+  "TIMESTAMP", "DELTA", "NODENAME", "NODESTATUS", "PROCS", "UPTIME",
+  "CPUCOUNT", "CPUCLOCK", "CPUMODEL", "SYSNAME", "RELEASE", "VERSION",
+  "MACHINE", "CPUUTIL", "MEMTOTAL", "MEMAVAIL", "MEMUSED", "MEMPERCENT",
+  "SWAPTOTAL", "SWAPFREE", "SWAPUSED", "SWAPPERCENT", "LOADAVG",
+  "NETTRANSMIT", "NETRECEIVE", "JSON_CT", "COMMAND", "ERROR",
+};
+
+// FNV-1a, like the node table
+static unsigned int
+hash_name(const char *s)
+{
+  unsigned int h = 2166136261u;
+
+  while (*s) {
+    h ^= (unsigned char) *s++;
+    h *= 16777619u;
+  }
+  return(h);
+}
+
+int
+wire_dict_init(wiredict *d)
+{
+  bzero(d, sizeof(wiredict));
+  d->nnames = 1;
+  d->nslots = 64;
+  d->names = calloc(d->nslots / 2, sizeof(char *));
+  d->slots = calloc(d->nslots, sizeof(int));
+  if (d->names == NULL || d->slots == NULL) {
+    perror("calloc");
+    wire_dict_free(d);
+    return(-1);
+  }
+  return(0);
+}
+
+// Id of name, 0 if it has none yet
+int
+wire_dict_id(wiredict *d, const char *name)
+{
+  unsigned int i = hash_name(name) & (d->nslots - 1);
+
+  for (; d->slots[i] != 0; i = (i + 1) & (d->nslots - 1)) {
+    if (strcmp(d->names[d->slots[i]], name) == 0) return(d->slots[i]);
+  }
+  return(0);
+}
+
+// Give name the next id. Returns it, or -1 if the dictionary is full.
+int
+wire_dict_add(wiredict *d, const char *name)
+{
+  if (d->nnames >= WIRE_MAXKEYS) return(-1);
+
+  // Kept at most half full, names grows along with the slots
+  if (d->nnames * 2 >= d->nslots) {
+    int newsize = d->nslots * 2;
+    int *slots = calloc(newsize, sizeof(int));
+    char **names = realloc(d->names, newsize / 2 * sizeof(char *));
+    if (names != NULL) d->names = names;
+    if (slots == NULL || names == NULL) {
+      free(slots);
+      return(-1);
+    }
+    for (int id = 1; id < d->nnames; id++) {
+      unsigned int i = hash_name(d->names[id]) & (newsize - 1);
+      while (slots[i] != 0) i = (i + 1) & (newsize - 1);
+      slots[i] = id;
+    }
+    free(d->slots);
+    d->slots = slots;
+    d->nslots = newsize;
+  }
+
+  if ((d->names[d->nnames] = strdup(name)) == NULL) return(-1);
+  unsigned int i = hash_name(name) & (d->nslots - 1);
+  while (d->slots[i] != 0) i = (i + 1) & (d->nslots - 1);
+  d->slots[i] = d->nnames;
+  return(d->nnames++);
+}
+
+// Forget the keys with ids of n and up, back to what both ends started
+// with. Each datagram of a connectionless peer is decoded this way.
+void
+wire_dict_trim(wiredict *d, int n)
+{
+  if (n < 1 || n >= d->nnames) return;
+  // Keys added later were probed past the ones kept, never the other way
+  for (int i = 0; i < d->nslots; i++) {
+    if (d->slots[i] >= n) d->slots[i] = 0;
+  }
+  for (int id = n; id < d->nnames; id++) free(d->names[id]);
+  d->nnames = n;
+}
+
+void
+wire_dict_free(wiredict *d)
+{
+  if (d->names != NULL) {
+    for (int id = 1; id < d->nnames; id++) free(d->names[id]);
+  }
+  free(d->names);
+  free(d->slots);
+  bzero(d, sizeof(wiredict));
+}
+
+// The built in keys, as the "KEYS" of a registration reply
+json_object *
+wire_keys(void)
+{
+  json_object *keys = json_object_new_array();
+
+  for (int i = 0; i < sizeof(builtin) / sizeof(builtin[0]); i++)
+    json_object_array_add(keys, json_object_new_string(builtin[i]));
+  return(keys);
+}
+
+// Dictionaries for a connection, seeded with keys (the "KEYS" the
+// aggregator replied with) or the built in ones if keys is NULL
+wireconn *
+wire_conn_new(json_object *keys)
+{
+  wireconn *c = calloc(1, sizeof(wireconn));
+  int n;
+
+  if (c == NULL) return(NULL);
+  if (wire_dict_init(&c->in) < 0 || wire_dict_init(&c->out) < 0) {
+    wire_conn_free(c);
+    return(NULL);
+  }
+
+  n = (keys != NULL) ? json_object_array_length(keys) : sizeof(builtin) / sizeof(builtin[0]);
+  for (int i = 0; i < n; i++) {
+    const char *name = (keys != NULL) ? json_object_get_string(json_object_array_get_idx(keys, i)) : builtin[i];
+    if (name == NULL || wire_dict_add(&c->in, name) < 0 || wire_dict_add(&c->out, name) < 0) {
+      wire_conn_free(c);
+      return(NULL);
+    }
+  }
+  return(c);
+}
+
+void
+wire_conn_free(wireconn *c)
+{
+  if (c == NULL) return;
+  wire_dict_free(&c->in);
+  wire_dict_free(&c->out);
+  free(c);
+}
+
+static int
+put(wirebuf *b, const void *data, size_t len)
+{
+  if (b->len + len > b->size) {
+    size_t newsize = b->size ? b->size : 256;
+    while (newsize < b->len + len) newsize *= 2;
+    char *tmp = realloc(b->buf, newsize);
+    if (tmp == NULL) {
+      perror("realloc");
+      return(-1);
+    }
+    b->buf = tmp;
+    b->size = newsize;
+  }
+  memcpy(b->buf + b->len, data, len);
+  b->len += len;
+  return(0);
+}
+
+static int
+put_byte(wirebuf *b, int c)
+{
+  unsigned char byte = c;
+
+  return(put(b, &byte, 1));
+}
+
+static int
+put_varint(wirebuf *b, uint64_t v)
+{
+  unsigned char tmp[10];
+  int n = 0;
+
+  do {
+    tmp[n] = v & 0x7f;
+    v >>= 7;
+    if (v) tmp[n] |= 0x80;
+    n++;
+  } while (v);
+  return(put(b, tmp, n));
+}
+
+static int
+put_key(wiredict *d, wirebuf *b, const char *name)
+{
+  int id = wire_dict_id(d, name);
+  size_t len = strlen(name);
+
+  if (id > 0) return(put_varint(b, id));
+  if (len == 0 || len > WIRE_MAXNAME) return(-1);
+
+  // Spelled out this once, the decoder adds it too unless the dictionary
+  // is full on both ends
+  wire_dict_add(d, name);
+  if (put_varint(b, 0) < 0 || put_varint(b, len) < 0) return(-1);
+  return(put(b, name, len));
+}
+
+static int
+encode(wiredict *d, json_object *val, wirebuf *b)
+{
+  switch (val != NULL ? json_object_get_type(val) : json_type_null) {
+  case json_type_null:
+    return(put_byte(b, WIRE_NULL));
+  case json_type_boolean:
+    return(put_byte(b, json_object_get_boolean(val) ? WIRE_TRUE : WIRE_FALSE));
+  case json_type_int: {
+    int64_t i = json_object_get_int64(val);
+    if (put_byte(b, WIRE_INT) < 0) return(-1);
+    return(put_varint(b, ((uint64_t) i << 1) ^ (uint64_t) (i >> 63)));
+  }
+  case json_type_double: {
+    double f = json_object_get_double(val);
+    uint64_t bits;
+    unsigned char tmp[8];
+    memcpy(&bits, &f, sizeof(bits));
+    for (int i = 0; i < 8; i++) tmp[i] = bits >> (8 * i);
+    if (put_byte(b, WIRE_DOUBLE) < 0) return(-1);
+    return(put(b, tmp, 8));
+  }
+  case json_type_string: {
+    int len = json_object_get_string_len(val);
+    if (put_byte(b, WIRE_STRING) < 0 || put_varint(b, len) < 0) return(-1);
+    return(put(b, json_object_get_string(val), len));
+  }
+  case json_type_object: {
+    if (put_byte(b, WIRE_OBJECT) < 0 || put_varint(b, json_object_object_length(val)) < 0) return(-1);
+    json_object_object_foreach(val, key, member) {
+      if (put_key(d, b, key) < 0 || encode(d, member, b) < 0) return(-1);
+    }
+    return(0);
+  }
+  case json_type_array: {
+    int n = json_object_array_length(val);
+    if (put_byte(b, WIRE_ARRAY) < 0 || put_varint(b, n) < 0) return(-1);
+    for (int i = 0; i < n; i++) {
+      if (encode(d, json_object_array_get_idx(val, i), b) < 0) return(-1);
+    }
+    return(0);
+  }
+  }
+  return(-1);
+}
+
+// Encode jobj into b, what was in it before is dropped. Keys new to d are
+// added to it, so the frame has to be sent once encoded.
+int
+wire_encode(wiredict *d, json_object *jobj, wirebuf *b)
+{
+  b->len = 0;
+  if (put_byte(b, WIRE_VERSION) < 0) return(-1);
+  return(encode(d, jobj, b));
+}
+
+void
+wire_buf_free(wirebuf *b)
+{
+  free(b->buf);
+  bzero(b, sizeof(wirebuf));
+}
+
+// What is left to decode of a frame
+typedef struct wire_reader {
+  const unsigned char *p;
+  const unsigned char *end;
+} wirereader;
+
+static int
+get_varint(wirereader *r, uint64_t *v)
+{
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (r->p >= r->end) return(-1);
+    unsigned char c = *r->p++;
+    *v |= (uint64_t) (c & 0x7f) << shift;
+    if (!(c & 0x80)) return(0);
+  }
+  return(-1);
+}
+
+// Length of something that still has to fit in the frame
+static int
+get_len(wirereader *r, size_t *len)
+{
+  uint64_t v;
+
+  if (get_varint(r, &v) < 0 || v > (uint64_t) (r->end - r->p)) return(-1);
+  *len = v;
+  return(0);
+}
+
+// Name of the next key, in name (of WIRE_MAXNAME + 1) if spelled out
+static const char *
+get_key(wiredict *d, wirereader *r, char *name)
+{
+  uint64_t id;
+  size_t len;
+
+  if (get_varint(r, &id) < 0) return(NULL);
+  if (id > 0) return(id < (uint64_t) d->nnames ? d->names[id] : NULL);
+
+  if (get_len(r, &len) < 0 || len == 0 || len > WIRE_MAXNAME ||
+      memchr(r->p, '\0', len) != NULL) return(NULL);
+  memcpy(name, r->p, len);
+  name[len] = '\0';
+  r->p += len;
+  if (wire_dict_id(d, name) == 0) wire_dict_add(d, name);
+  return(name);
+}
+
+// Decode the next value into *val, NULL for a null. Returns -1 if the
+// frame is cut short, nested too deep or not ours.
+static int
+decode(wiredict *d, wirereader *r, int depth, json_object **val)
+{
+  char name[WIRE_MAXNAME + 1];
+  const char *key;
+  json_object *member;
+  uint64_t v;
+  size_t n;
+
+  *val = NULL;
+  if (r->p >= r->end || depth > WIRE_MAXDEPTH) return(-1);
+
+  switch (*r->p++) {
+  case WIRE_NULL:
+    return(0);
+  case WIRE_FALSE:
+  case WIRE_TRUE:
+    *val = json_object_new_boolean(r->p[-1] == WIRE_TRUE);
+    return(0);
+  case WIRE_INT:
+    if (get_varint(r, &v) < 0) return(-1);
+    *val = json_object_new_int64((int64_t) (v >> 1) ^ -(int64_t) (v & 1));
+    return(0);
+  case WIRE_DOUBLE: {
+    double f;
+    if (r->end - r->p < 8) return(-1);
+    v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t) r->p[i] << (8 * i);
+    r->p += 8;
+    memcpy(&f, &v, sizeof(f));
+    *val = json_object_new_double(f);
+    return(0);
+  }
+  case WIRE_STRING:
+    if (get_len(r, &n) < 0) return(-1);
+    *val = json_object_new_string_len((const char *) r->p, n);
+    r->p += n;
+    return(0);
+  case WIRE_OBJECT:
+    if (get_len(r, &n) < 0) return(-1);
+    *val = json_object_new_object();
+    for (size_t i = 0; i < n; i++) {
+      if ((key = get_key(d, r, name)) == NULL || decode(d, r, depth + 1, &member) < 0) {
+        json_object_put(*val);
+        *val = NULL;
+        return(-1);
+      }
+      json_object_object_add(*val, key, member);
+    }
+    return(0);
+  case WIRE_ARRAY:
+    if (get_len(r, &n) < 0) return(-1);
+    *val = json_object_new_array();
+    for (size_t i = 0; i < n; i++) {
+      if (decode(d, r, depth + 1, &member) < 0) {
+        json_object_put(*val);
+        *val = NULL;
+        return(-1);
+      }
+      json_object_array_add(*val, member);
+    }
+    return(0);
+  }
+  return(-1);
+}
+
+// The value of a frame of len bytes, NULL if it is not one we can take.
+// Keys it spells out are added to d.
+json_object *
+wire_decode(wiredict *d, const char *buf, int len)
+{
+  wirereader r = { (const unsigned char *) buf, (const unsigned char *) buf + len };
+  json_object *jobj;
+
+  if (len < 1 || *r.p++ != WIRE_VERSION) return(NULL);
+  if (decode(d, &r, 0, &jobj) < 0 || r.p != r.end) {
+    if (jobj != NULL) json_object_put(jobj);
+    return(NULL);
+  }
+  return(jobj);
+}
+
+// send_json() for a peer speaking the binary encoding
+int
+send_wire(int sock, wiredict *d, json_object *jobj)
+{
+  struct utsname unameinfo;
+  wirebuf b = { NULL, 0, 0 };
+  apphdr app_h;
+  int rval;
+
+  uname(&unameinfo);
+  // Room for the header first, filled in once the length is known
+  if (put(&b, &app_h, sizeof(app_h)) < 0 || put_byte(&b, WIRE_VERSION) < 0 ||
+      encode(d, jobj, &b) < 0 || b.len - sizeof(app_h) > MAXFRAMELEN) {
+    wire_buf_free(&b);
+    return(-1);
+  }
+  bzero(&app_h, sizeof(app_h));
+  app_h.len = (b.len - sizeof(app_h)) | APPHDR_BINARY;
+  app_h.timestamp = time(NULL);
+  strncpy(app_h.nodename, unameinfo.nodename, MAX_NODENAME_LEN-1);
+  memcpy(b.buf, &app_h, sizeof(app_h));
+  rval = sendall(sock, b.buf, b.len);
+  wire_buf_free(&b);
+  return(rval);
+}
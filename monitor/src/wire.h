@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2001-2003 Gregory M. Kurtzer
+ *
+ * Copyright (c) 2003-2011, The Regents of the University of California,
+ * through Lawrence Berkeley National Laboratory (subject to receipt of any
+ * required approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Contributed by Anthony Salgado & Krishna Muriki
+ * Warewulf Monitor (wire.h)
+ *
+ */
+
+#ifndef _WIRE_H
+#define _WIRE_H  1
+
+#include <json/json.h>
+
+#include "globals.h"
+
+#define WIRE_VERSION 1
+
+// Types of the values
+#define WIRE_NULL 0
+#define WIRE_FALSE 1
+#define WIRE_TRUE 2
+#define WIRE_INT 3      // zigzag varint
+#define WIRE_DOUBLE 4   // 8 bytes, little endian IEEE 754
+#define WIRE_STRING 5   // varint length, bytes
+#define WIRE_OBJECT 6   // varint # of members, each a key and a value
+#define WIRE_ARRAY 7    // varint # of values, the values
+
+// Key names by id, for one direction of one connection. Both ends start
+// with the same built in keys and add the same ones in the same order.
+typedef struct wire_dict {
+
+	char    **names;   // by id, 0 is not a key
+	int     nnames;
+	int     *slots;    // ids by hash of name, open addressing, 0 if free
+	int     nslots;    // always a power of 2
+
+} wiredict;
+
+// What a connection speaking the binary encoding needs
+typedef struct wire_conn {
+
+	wiredict in;       // keys of what we receive
+	wiredict out;      // keys of what we send
+
+} wireconn;
+
+// A growing buffer for encoding into
+typedef struct wire_buffer {
+
+	char    *buf;
+	size_t  len;
+	size_t  size;
+
+} wirebuf;
+
+int wire_dict_init(wiredict*);
+int wire_dict_id(wiredict*, const char*);
+int wire_dict_add(wiredict*, const char*);
+void wire_dict_trim(wiredict*, int);
+void wire_dict_free(wiredict*);
+json_object *wire_keys(void);
+wireconn *wire_conn_new(json_object*);
+void wire_conn_free(wireconn*);
+int wire_encode(wiredict*, json_object*, wirebuf*);
+json_object *wire_decode(wiredict*, const char*, int);
+void wire_buf_free(wirebuf*);
+int send_wire(int, wiredict*, json_object*);
+
+#endif /* _WIRE_H */
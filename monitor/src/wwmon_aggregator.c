@@ -10,6 +10,8 @@
  *
  */
 
+#define _GNU_SOURCE  // recvmmsg()
+
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
@@ -26,6 +28,11 @@
 #include <time.h>
 #include <ctype.h>
 #include <sys/utsname.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <json/json.h>
 #include <sqlite3.h>
@@ -33,9 +40,117 @@
 #include "config.h"
 #include "globals.h"
 #include "util.h"
+#include "dbstore.h"
+#include "nodetable.h"
+#include "qcache.h"
+#include "subscribe.h"
+#include "wire.h"
+#include "compress.h"
+#include "legacy.h"
 
 //Database to hold data of each socket -- To be passed all over the place.
 static sqlite3 *db; // database pointer
+// Workers share the database, only one of them may use it at a time
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+static dbstore store; // Prepared statements & batching of our writes
+// Current state of every node, ingest & queries of all nodes use this and
+// the flusher thread writes it behind to the database
+static nodetable nodes;
+// Replies to application queries, so the same query from many dashboards
+// is answered once per change of the data (or per ttl while it changes)
+static qcache cache;
+// Bumped after every write of the datastore, what SQL queries read
+static uint64_t dbgen;
+
+// Our nodename, put in the header of every reply
+static char hostname[MAX_NODENAME_LEN];
+
+// Aggregator we forward our nodes to, if any, see forwardLoop()
+static char *upstream_host;
+static int upstream_port;
+static int forward_interval = FORWARD_INTERVAL;
+
+// UDP port of packets from the legacy wulfd, 0 if we don't take them
+static int legacy_port;
+
+// Each worker owns its listening sockets, event loop and connections
+typedef struct aggregator_worker {
+  int id;
+  pthread_t tid;
+  int port;
+
+  int epfd;  // epoll instance driving the event loop
+  int stcp;  // TCP listen socket
+  int sudp;  // UDP socket
+  int sleg;  // UDP socket of legacy_port, -1 if none
+  int tfd;   // timer for pushes to subscribers, every SUBSCRIBE_TICK
+  int spare; // fd given up to accept and close a connection when out of them
+  int accept_paused;  // out of memory, accepts are retried every tick
+
+  // What readUDP() reads a batch of datagrams into
+  struct mmsghdr *udpmsgs;
+  struct iovec *udpiov;
+  struct sockaddr_in *udpaddrs;
+  char *udpbufs;     // UDP_BATCH of UDP_MAXDGRAM + 1 bytes
+  wiredict udpdict;  // the built in keys, see wire_dict_trim()
+  int udpkeys;       // # of them
+
+  //Table with values of each socket, indexed by fd and grown on demand
+  sockdata *sock_data;
+  int sock_data_size;
+} worker;
+
+int
+sockdata_reserve(worker *w, int fd)
+{
+  if (fd < w->sock_data_size) return(0);
+
+  int newsize = w->sock_data_size ? w->sock_data_size : SOCKDATA_MINSIZE;
+  while (newsize <= fd) newsize *= 2;
+
+  sockdata *tmp = realloc(w->sock_data, newsize * sizeof(sockdata));
+  if (tmp == NULL) {
+    perror("realloc");
+    return(-1);
+  }
+  bzero(tmp + w->sock_data_size, (newsize - w->sock_data_size) * sizeof(sockdata));
+  w->sock_data = tmp;
+  w->sock_data_size = newsize;
+  return(0);
+}
+
+void
+closeConn(worker *w, int fd)
+{
+  // Closing the fd also drops it from the epoll set
+  close(fd);
+  frame_free(&w->sock_data[fd].in);
+  if(w->sock_data[fd].sqlite_cmd != NULL) free(w->sock_data[fd].sqlite_cmd);
+  if(w->sock_data[fd].request != NULL) json_object_put(w->sock_data[fd].request);
+  subscribe_free(w->sock_data[fd].sub);
+  wire_conn_free(w->sock_data[fd].wire);
+  outq_free(&w->sock_data[fd].outq);
+  bzero(&w->sock_data[fd], sizeof(sockdata));
+}
+
+// Push out what the socket will take of its queue without blocking.
+// Returns -1 if the connection had to be closed, 1 if reading was
+// paused and can now resume, 0 otherwise.
+int
+flushConn(worker *w, int fd)
+{
+  int pending;
+
+  if((pending = outq_flush(fd, &w->sock_data[fd].outq)) < 0) {
+    closeConn(w, fd);
+    return(-1);
+  }
+  if(w->sock_data[fd].rd_blocked && pending < OUTQ_LOWWATER) {
+    w->sock_data[fd].rd_blocked = 0;
+    return(1);
+  }
+  return(0);
+}
 
 int
 json_from_db(void *void_json, int ncolumns, char **col_values, char **col_names)
@@ -63,260 +178,613 @@ json_from_db(void *void_json, int ncolumns, char **col_values, char **col_names)
   return 0;
 }
 
+// Answer a datagram that is not a sample with the whole datastore
 void
-update_dbase(time_t TimeStamp, char *NodeName, json_object *jobj)
+dumpData(int fd, struct sockaddr_in *their_addr, char *buf, int numbytes)
 {
-  //printf("NodeName - %s, TimeStamp - %ld\n", NodeName, TimeStamp);
+  json_object *json_db = json_object_new_object();
 
-  // Now check if the NodeName exists in the datastore table 
-  // If so compare the timestamp values and decide what to do.
+  printf("got packet from %s\n",inet_ntoa(their_addr->sin_addr));
+  printf("packet is %d bytes long\n",numbytes);
+  printf("packet contains \"%s\"\n",buf);
+
+  pthread_mutex_lock(&db_lock);
+  sqlite3_exec(db, "select rowid,NodeName,key,value from wwstats", json_from_db, json_db, NULL);
+  pthread_mutex_unlock(&db_lock);
 
-  int DBTimeStamp = -1;
-  int blobid = -1;
-  int overwrite = 0;
-  if ( (DBTimeStamp = NodeTS_fromDB(NodeName, db)) == -1 ) { // PKT with data from a new node 
-    insert_json(NodeName, TimeStamp, jobj, db);
-    blobid = NodeBID_fromDB(NodeName, db);
-    insertLookups(blobid, jobj, db);
+  // send json_object over socket to wwstats
+  if ((numbytes=sendto(fd, json_object_to_json_string(json_db), strlen(json_object_to_json_string(json_db)), 0,
+		       (struct sockaddr *)their_addr, sizeof(struct sockaddr))) == -1) {
+    perror("sendto");
+  }  
+  printf("sent %d bytes to %s\n", numbytes, inet_ntoa(their_addr->sin_addr));
+  json_object_put(json_db);
+}
+
+// Whether a datagram is a sample from a collector sending over UDP, one
+// apphdr and its payload, nothing more or less
+int
+isSample(const char *buf, int len)
+{
+  const apphdr *hdr = (const apphdr *) buf;
 
-  } else if ( DBTimeStamp < TimeStamp ) { // PKT with newer time stamp
+  return(len >= sizeof(apphdr) &&
+         (hdr->len & ~APPHDR_FLAGS) == len - sizeof(apphdr) &&
+         !(hdr->len & APPHDR_COMPRESS) &&
+         hdr->nodename[0] != '\0' &&
+         memchr(hdr->nodename, '\0', MAX_NODENAME_LEN) != NULL);
+}
 
-    blobid = NodeBID_fromDB(NodeName, db);
-    overwrite = 1;
-    update_insertLookups(blobid, jobj, db, overwrite);
-    merge_json(NodeName, TimeStamp, jobj, db, overwrite);
-    printf("Just finished processing PKT with newer time stamp\n");
+// Drain a UDP socket, UDP_BATCH datagrams per recvmmsg(). Samples are
+// merged into the node table a batch at a time, there is no connection
+// or registration to them. Binary ones are decoded with the built in keys
+// plus what each defines itself. On the legacy socket every datagram is
+// a wulfd packet, see legacy.c.
+int
+readUDP(worker *w, int fd)
+{
+  nodesample samples[UDP_BATCH];
+  int n, ns;
 
-  } else if (DBTimeStamp >= TimeStamp ) { // PKT with same time stamp or with older time stamp
+  do {
+    for(int i = 0; i < UDP_BATCH; i++)
+      w->udpmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
 
-    blobid = NodeBID_fromDB(NodeName, db);
-    overwrite = 0;
-    printf("About to update & insert\n");
-    update_insertLookups(blobid, jobj, db, overwrite);
-    printf("Just finished half processing PKT with older or same time stamp\n");
-    merge_json(NodeName, TimeStamp, jobj, db, overwrite);
-    printf("Just finished processing PKT with older or same time stamp\n");
+    if((n = recvmmsg(fd, w->udpmsgs, UDP_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+      if(errno == EINTR) continue;
+      if(errno != EAGAIN && errno != EWOULDBLOCK) perror("recvmmsg");
+      return(-1);
+    }
 
+    ns = 0;
+    for(int i = 0; i < n; i++) {
+      char *buf = w->udpiov[i].iov_base;
+      int len = w->udpmsgs[i].msg_len;
+      apphdr *hdr = (apphdr *) buf;
+      json_object *jobj;
+
+      buf[len] = '\0';
+      if(w->udpmsgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        printf("Datagram of over %d bytes dropped\n", UDP_MAXDGRAM);
+        continue;
+      }
+      if(fd == w->sleg) {
+        // Their time is ours, wulfd sends none
+        if((jobj = legacy_parse(buf, len, &samples[ns].nodename)) != NULL) {
+          samples[ns].timestamp = time(NULL);
+          samples[ns++].jobj = jobj;
+        }
+        continue;
+      }
+      if(!isSample(buf, len)) {
+        dumpData(w->sudp, &w->udpaddrs[i], buf, len);
+        continue;
+      }
+      if(hdr->len & APPHDR_BINARY) {
+        jobj = wire_decode(&w->udpdict, buf + sizeof(apphdr), len - sizeof(apphdr));
+        wire_dict_trim(&w->udpdict, w->udpkeys);
+      } else {
+        jobj = json_tokener_parse(buf + sizeof(apphdr));
+      }
+      if(jobj == NULL || !json_object_is_type(jobj, json_type_object)) {
+        printf("Not able to parse the sample of %s\n", hdr->nodename);
+        if(jobj != NULL) json_object_put(jobj);
+        continue;
+      }
+      samples[ns].nodename = hdr->nodename;
+      samples[ns].timestamp = hdr->timestamp;
+      samples[ns++].jobj = jobj;
+    }
+
+    // Takes the samples, they are freed with the lock held
+    if(ns > 0) nodetable_update_many(&nodes, samples, ns);
+  } while(n == UDP_BATCH);
+
+  return(0);
+}
+
+// Answer {"history": "CPUUTIL,LOADAVG", "from": t0, "to": t1, "step": 60,
+// "func": "max"} with the samples each node passing f has in that time
+// range. Every key is optional, the default is all metrics with history
+// over all we keep in memory. A step over HISTORY_STEP reads the archives,
+// func picks the rollup of them (min, max, avg or last).
+void
+historyReply(json_object *req, filter *f, json_object *reply)
+{
+  int metrics[HISTORY_NMETRICS];
+  int nmetrics = 0;
+  json_object *val;
+  time_t to = time(NULL), from = 0;
+  int step = HISTORY_STEP;
+  int func = RRA_AVG;
+
+  const char *names = json_object_get_string(json_object_object_get(req, "history"));
+  if(names != NULL && *names != '\0') {
+    char *list = strdup(names), *saveptr, *name;
+    for(name = strtok_r(list, ",", &saveptr); name != NULL && nmetrics < HISTORY_NMETRICS; name = strtok_r(NULL, ",", &saveptr)) {
+      int m = history_metric_id(name);
+      if(m >= 0) metrics[nmetrics++] = m;
+    }
+    free(list);
+  } else {
+    for(nmetrics = 0; nmetrics < HISTORY_NMETRICS; nmetrics++) metrics[nmetrics] = nmetrics;
   }
+
+  if((val = json_object_object_get(req, "to")) != NULL) to = json_object_get_int(val);
+  if((val = json_object_object_get(req, "from")) != NULL) from = json_object_get_int(val);
+  if((val = json_object_object_get(req, "step")) != NULL) step = json_object_get_int(val);
+  if((val = json_object_object_get(req, "func")) != NULL && rra_func_id(json_object_get_string(val)) >= 0)
+    func = rra_func_id(json_object_get_string(val));
+
+  nodetable_history(&nodes, f, step, func, from, to, metrics, nmetrics, reply);
 }
 
+// Answer a request with "filter" and/or "nodes" keys, like
+// {"filter": "CPUUTIL > 90 and NODESTATUS = ready", "nodes": "n00*,gpu[1-4]"}
+// from the node table, with its history if it has a "history" key too.
+// The filter is compiled once and then run over every node.
 void
-readndumpData(int fd)
+requestReply(json_object *req, json_object *reply)
 {
+  char err[MAX_SQL_SIZE];
+  filter *f;
+
+  f = filter_compile(json_object_get_string(json_object_object_get(req, "filter")),
+                     json_object_get_string(json_object_object_get(req, "nodes")), err, sizeof(err));
+  if(f == NULL) {
+    json_object_object_add(reply, "JSON_CT", json_object_new_int(0));
+    json_object_object_add(reply, "ERROR", json_object_new_string(err));
+    return;
+  }
 
-  struct sockaddr_in their_addr;
-  int addr_len, numbytes;
-  char buf[MAXPKTSIZE];
-  json_object *json_db = json_object_new_object();
+  if(json_object_object_get(req, "history") != NULL) {
+    historyReply(req, f, reply);
+  } else {
+    nodetable_select(&nodes, f, reply);
+  }
+  filter_free(f);
+}
 
-  addr_len = sizeof(struct sockaddr);
-  if ((numbytes=recvfrom(fd, buf, MAXPKTSIZE-1 , 0,
-              (struct sockaddr *)&their_addr, &addr_len)) == -1) {
-      perror("recvfrom");
+// Take in a batch from an aggregator below us (see forwardLoop()), node
+// name to JSON string of the node: all of it with "SNAPSHOT" set, only
+// what changed otherwise. Nodes it "DROPPED" expire here on their own.
+void
+forwardUpdate(json_object *batch, time_t timestamp)
+{
+  int snapshot = (json_object_object_get(batch, "SNAPSHOT") != NULL);
+
+  json_object_object_foreach(batch, node, blob) {
+    json_object *jobj, *ts;
+
+    // Skips JSON_CT, SNAPSHOT and DROPPED too
+    if(blob == NULL || json_object_get_type(blob) != json_type_string)
+      continue;
+    if((jobj = json_tokener_parse(json_object_get_string(blob))) == NULL)
+      continue;
+    if(!snapshot)
+      json_object_object_add(jobj, "DELTA", json_object_new_int(1));
+    ts = json_object_object_get(jobj, "TIMESTAMP");
+    nodetable_update(&nodes, node, (ts != NULL) ? json_object_get_int(ts) : timestamp, jobj);
   }
-  printf("got packet from %s\n",inet_ntoa(their_addr.sin_addr));
-  printf("packet is %d bytes long\n",numbytes);
-  buf[numbytes] = '\0';
-  printf("packet contains \"%s\"\n",buf);
+}
 
-  sqlite3_exec(db, "select rowid,NodeName,key,value from wwstats", json_from_db, json_db, NULL);
+// Queue jobj on the socket, in the binary encoding if binary, compressed
+// if the socket registered for that and it is big enough. Kept in the
+// cache under key as queued, unless key is NULL or empty.
+int
+queueJson(sockdata *sd, json_object *jobj, int binary, const char *key, uint64_t gen)
+{
+  wirebuf b = { NULL, 0, 0 };
+  const char *payload;
+  char *zbuf = NULL;
+  size_t len, zlen;
+  int flags = 0, zflag, rval;
+
+  if(binary) {
+    if(wire_encode(&sd->wire->out, jobj, &b) < 0) {
+      wire_buf_free(&b);
+      return(-1);
+    }
+    payload = b.buf;
+    len = b.len;
+    flags = APPHDR_BINARY;
+  } else {
+    payload = json_object_to_json_string(jobj);
+    len = strlen(payload);
+  }
 
-  // send json_object over socket to wwstats
-  if ((numbytes=sendto(fd, json_object_to_json_string(json_db), strlen(json_object_to_json_string(json_db)), 0,
-		       (struct sockaddr *)&their_addr, sizeof(struct sockaddr))) == -1) {
-    perror("sendto");
-  }  
-  printf("sent %d bytes to %s\n", numbytes, inet_ntoa(their_addr.sin_addr));
+  if((zflag = compress_frame(sd->compress, payload, len, &zbuf, &zlen)) != 0) {
+    payload = zbuf;
+    len = zlen;
+    flags |= zflag;
+  }
 
-  return;
+  if(key != NULL && key[0] != '\0')
+    qcache_put(&cache, key, gen, payload, len, flags);
+  rval = outq_add_frame(&sd->outq, payload, len, flags, hostname);
+  free(zbuf);
+  wire_buf_free(&b);
+  return(rval);
 }
 
+// A subscriber sent the nodes it wants, like {"filter": "NODESTATUS = ready",
+// "nodes": "n00*", "interval": 5}. Answer with all of them now, after
+// that only what changed of them is pushed, see pushUpdates().
+void
+subscribeReply(worker *w, int fd, json_object *reply)
+{
+  char err[MAX_SQL_SIZE];
+  subscription *sub;
+
+  if((sub = subscribe_new(w->sock_data[fd].request, err, sizeof(err))) == NULL) {
+    json_object_object_add(reply, "JSON_CT", json_object_new_int(0));
+    json_object_object_add(reply, "ERROR", json_object_new_string(err));
+    return;
+  }
+  // A new filter replaces the old, starting over with a snapshot
+  subscribe_free(w->sock_data[fd].sub);
+  w->sock_data[fd].sub = sub;
+  subscribe_push(sub, &nodes, time(NULL), 1, reply);
+}
+
+// Send every subscriber of this worker what changed of its nodes since
+// its last push, if one is due. A subscriber still behind on reading gets
+// nothing more queued, its next push covers the changes missed meanwhile.
+void
+pushUpdates(worker *w)
+{
+  time_t now = time(NULL);
+
+  for(int fd = 0; fd < w->sock_data_size; fd++) {
+    sockdata *sd = &w->sock_data[fd];
+    if(sd->ctype != SUBSCRIBE || sd->sub == NULL || outq_pending(&sd->outq) >= OUTQ_LOWWATER)
+      continue;
+
+    json_object *jobj = json_object_new_object();
+    int rval = 0;
+    if(subscribe_push(sd->sub, &nodes, now, 0, jobj) > 0)
+      rval = queueJson(sd, jobj, sd->wire != NULL, NULL, 0);
+    json_object_put(jobj);
+    if(rval < 0) {
+      closeConn(w, fd);
+      continue;
+    }
+    if(outq_pending(&sd->outq) > 0)
+      flushConn(w, fd);
+  }
+}
+
+// Key of the cached reply to the request on the socket and the generation
+// of the data it is built from. Returns 0 if there is nothing to cache.
 int
-writeHandler(int fd) 
+cacheKey(sockdata *sd, char *key, int keylen, uint64_t *gen)
 {
-  // Should we assume that even the TCP send's cannot be made when we want ?
-  // In other words is it possible that TCP send's would wait or get stuck ? 
-  // If so we cannot use send_json instead improve the logic here -- kmuriki
-  
-  fprintf(stderr,"About to write on FD - %d, type - %d\n",fd,sock_data[fd].ctype);
+  static const char *fields[] = { "filter", "nodes", "history", "from", "to", "step", "func" };
+
+  key[0] = '\0';
+  if(sd->request != NULL) {
+    // Same order of keys whatever order the client sent them in
+    for(int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+      json_object *val = json_object_object_get(sd->request, fields[i]);
+      int len = strlen(key);
+      if(snprintf(key + len, keylen - len, "%s%s=", i ? "\x1f" : "R:", fields[i]) >= keylen - len ||
+         (val != NULL && qcache_normalize(key, keylen, json_object_get_string(val)) < 0))
+        return(0);
+    }
+    *gen = nodetable_gen(&nodes);
+  } else if(sd->query_all) {
+    strcpy(key, "A:");
+    *gen = nodetable_gen(&nodes);
+  } else if(sd->sqlite_cmd != NULL) {
+    strcpy(key, "S:");
+    if(qcache_normalize(key, keylen, sd->sqlite_cmd) < 0) return(0);
+    *gen = __atomic_load_n(&dbgen, __ATOMIC_ACQUIRE);
+  } else {
+    return(0);
+  }
+  return(1);
+}
+
+// Queue the response to the request just read (a registration if reg)
+// and start sending it. Replies only ever wait in the socket's own queue,
+// so a slow reader can not hold up any other connection.
+int
+queueReply(worker *w, int fd, int reg) 
+{
+  fprintf(stderr,"About to queue reply on FD - %d, type - %d\n",fd,w->sock_data[fd].ctype);
  
   char payload[1024];
+  char key[MAX_SQL_SIZE + 64] = "";
+  uint64_t gen = 0;
+  int cached = 0, rval = 0;
+  // Peers that registered for the binary encoding get it from the next
+  // reply on, but for the acks of collectors. Those replies hold keys new
+  // to the peer at times, so they can not be kept in the cache.
+  wireconn *wire = w->sock_data[fd].wire;
+  int binary = (wire != NULL && !reg && w->sock_data[fd].ctype != COLLECTOR);
   
-  json_object *jobj;
+  json_object *jobj = NULL;
+
+  if(w->sock_data[fd].ctype == APPLICATION && !binary && cacheKey(&w->sock_data[fd], key, sizeof(key), &gen)) {
+      // Compressed replies are kept apart from plain ones
+      int n = strlen(key);
+      if(w->sock_data[fd].compress &&
+         snprintf(key + n, sizeof(key) - n, "\x1e%s", compress_name(w->sock_data[fd].compress)) >= sizeof(key) - n) {
+          key[0] = '\0';
+      } else {
+          cached = qcache_get(&cache, key, gen, &w->sock_data[fd].outq, hostname);
+          if(cached < 0) rval = -1;
+      }
+  }
+
+  if(!cached) {
   jobj = json_object_new_object();
 
-  if(sock_data[fd].ctype == UNKNOWN) {
+  if(w->sock_data[fd].ctype == UNKNOWN) {
       strcpy(payload,"Send Type");
       json_object_object_add(jobj,"COMMAND",json_object_new_string(payload));
-  } else if(sock_data[fd].ctype == COLLECTOR) {
+  } else if(w->sock_data[fd].ctype == COLLECTOR || w->sock_data[fd].ctype == FORWARDER) {
       strcpy(payload,"Send Data");
       json_object_object_add(jobj,"COMMAND",json_object_new_string(payload));
-  } else if(sock_data[fd].ctype == APPLICATION) {
-      if(sock_data[fd].sqlite_cmd != NULL){
-          //printf("SQL cmd - %s\n", sock_data[fd].sqlite_cmd);
+  } else if(w->sock_data[fd].ctype == SUBSCRIBE) {
+      if(w->sock_data[fd].request != NULL) {
+          subscribeReply(w, fd, jobj);
+      } else {
+          strcpy(payload,"Send Filter");
+          json_object_object_add(jobj,"COMMAND",json_object_new_string(payload));
+      }
+  } else if(w->sock_data[fd].ctype == APPLICATION) {
+      if(w->sock_data[fd].request != NULL) {
+          requestReply(w->sock_data[fd].request, jobj);
+      } else if(w->sock_data[fd].query_all) {
+          nodetable_dump(&nodes, jobj);
+      } else if(w->sock_data[fd].sqlite_cmd != NULL){
+          //printf("SQL cmd - %s\n", w->sock_data[fd].sqlite_cmd);
           json_object_object_add(jobj,"JSON_CT",json_object_new_int(0));
-          sqlite3_exec(db, sock_data[fd].sqlite_cmd, json_from_db, jobj, NULL);
+          pthread_mutex_lock(&db_lock);
+          sqlite3_exec(db, w->sock_data[fd].sqlite_cmd, json_from_db, jobj, NULL);
+          pthread_mutex_unlock(&db_lock);
           //printf("JSON - %s\n",json_object_to_json_string(jobj));
-  	  free(sock_data[fd].sqlite_cmd);
       } else {
           strcpy(payload,"Send SQL query");
           json_object_object_add(jobj,"COMMAND",json_object_new_string(payload));
       }
   } 
 
-  send_json(fd,jobj);
+  if(reg && wire != NULL) {
+      json_object_object_add(jobj,"ENCODING",json_object_new_string(WIRE_ENCODING));
+      json_object_object_add(jobj,"KEYS",wire_keys());
+  }
+  if(reg && w->sock_data[fd].compress)
+      json_object_object_add(jobj,"COMPRESS",json_object_new_string(compress_name(w->sock_data[fd].compress)));
+
+  rval = queueJson(&w->sock_data[fd], jobj, binary, key, gen);
   json_object_put(jobj);
-  //printf("send successful!\n");
+  }
 
-  FD_CLR(fd, &wfds);
-  FD_SET(fd, &rfds);
+  if(w->sock_data[fd].request != NULL) json_object_put(w->sock_data[fd].request);
+  if(w->sock_data[fd].sqlite_cmd != NULL) free(w->sock_data[fd].sqlite_cmd);
+  w->sock_data[fd].sqlite_cmd = NULL;
+  w->sock_data[fd].query_all = 0;
+  w->sock_data[fd].request = NULL;
+
+  if(rval < 0) {
+    closeConn(w, fd);
+    return(-1);
+  }
+
+  if(flushConn(w, fd) < 0)
+    return(-1);
+
+  // Backpressure, leave further requests in the socket till this drains
+  if(outq_pending(&w->sock_data[fd].outq) >= OUTQ_HIGHWATER)
+    w->sock_data[fd].rd_blocked = 1;
 
   return(0);
 }
 
+// The socket has room again, resume sending the queued replies
 int
-readHandler(int fd)
+writeHandler(worker *w, int fd) 
 {
-  fprintf(stderr,"About to read on FD - %d, type - %d\n",fd,sock_data[fd].ctype);
+  fprintf(stderr,"About to write on FD - %d, type - %d\n",fd,w->sock_data[fd].ctype);
+
+  return(flushConn(w, fd));
+}
+
+int
+readHandler(worker *w, int fd)
+{
+  fprintf(stderr,"About to read on FD - %d, type - %d\n",fd,w->sock_data[fd].ctype);
 
-  char rbuf[MAXPKTSIZE];
-  rbuf[0] = '\0';
-  int readbytes;
   json_object *jobj;
+  framedec *in;
+  int rc;
 
-  // First check if there is any remaining payload from previous
-  // transmission for this socket and decide the # of bytes to read.
-  int numtoread;
-  if( sock_data[fd].r_payloadlen > 0 && sock_data[fd].r_payloadlen < MAXPKTSIZE-1 ) {
-      numtoread = sock_data[fd].r_payloadlen;
-  } else {
-      numtoread = MAXPKTSIZE-1;
-  }
+  // Edge triggered, so keep reading packets till the socket has nothing
+  // more for us or its reply queue is backed up.
+  while(!w->sock_data[fd].rd_blocked) {
 
-  if ((readbytes=recv(fd, rbuf, numtoread, 0)) == -1) {
-      perror("recv");
-      FD_CLR(fd, &rfds);
-      close(fd);
-      return(0);
+  in = &w->sock_data[fd].in;
+  if ((rc = frame_recv(fd, in)) == FRAME_MORE) {
+    // Drained, wait for the next edge
+    return(0);
   }
-  rbuf[readbytes]='\0';
-  //fprintf(stderr, "Rx a string of size %d - %s\n",readbytes,rbuf);
-  //fprintf(stderr, "Rx a string of size %d \n",readbytes);
-
-  // Is this required ?
-  if (strlen(rbuf) == 0)
-  {
+  if (rc == FRAME_CLOSED) {
       fprintf(stderr,"\nSeams like the remote client connected\n");
       fprintf(stderr,"to this socket has closed its connection\n");
       fprintf(stderr,"So I'm closing the socket\n");
-      FD_CLR(fd, &rfds);
-      close(fd);
-      return(0);
-  }
- 
-  // If the read buffer is from pending transmission append to accuralbuf
-  // Or else treat it as a new packet.
-  if (sock_data[fd].r_payloadlen > 0) {
-     strcat(sock_data[fd].accural_buf,rbuf);
-     sock_data[fd].r_payloadlen = sock_data[fd].r_payloadlen - readbytes;
-  } else {
-     apphdr *app_h = (apphdr *) rbuf;
-     appdata *app_d = (appdata *) (rbuf + sizeof(apphdr));
-
-     //printf("Len of the payload - %d, %s\n", app_h->len,app_d->payload);
- 
-     // plus 1 to store the NULL char
-     sock_data[fd].accural_buf = (char *) malloc(app_h->len+1);
-     strcpy(sock_data[fd].accural_buf,app_d->payload);
-     sock_data[fd].r_payloadlen = app_h->len - strlen(sock_data[fd].accural_buf);
-     //printf("strlen(sock_data[%d].accural_buf) = %d\n", fd, strlen(sock_data[fd].accural_buf));
   }
-
-  if (sock_data[fd].r_payloadlen > 0) {
-     //Still has more reading to do
-    //printf("r_payloadlen = %d\n", sock_data[fd].r_payloadlen);
-    return(0);
+  if (rc != FRAME_DONE) {
+      closeConn(w, fd);
+      return(0);
   }
 
   printf("Done reading totally, now processing the received data packet\n");
 
-/*
-  if(sock_data[fd].ctype == UNKNOWN) {
-	int ctype;
-	ctype = get_int_from_json(json_tokener_parse(sock_data[fd].accural_buf),"CONN_TYPE");
-	if(ctype == -1) {
-	  printf("Not able to determine type\n");
-	} else {
-	  sock_data[fd].ctype = ctype;
-	  //printf("Conn type - %d on sock - %d\n",ctype, fd);
-	}
-   } else if(sock_data[fd].ctype == COLLECTOR) {
-*/
-
   int ctype;
   int is_reg_pkt = 0;
-  ctype = get_int_from_json(json_tokener_parse(sock_data[fd].accural_buf),"CONN_TYPE");
+  if(in->flags & APPHDR_COMPRESS) {
+    // We only ever send those
+    printf("Compressed packet, closing the connection\n");
+    closeConn(w, fd);
+    return(0);
+  }
+  if(in->flags & APPHDR_BINARY) {
+    // Keys it spelled out would be missing from then on, so a frame we
+    // can not decode ends the connection
+    if(w->sock_data[fd].wire == NULL ||
+       (jobj = wire_decode(&w->sock_data[fd].wire->in, in->buf, in->got)) == NULL) {
+      printf("Not able to decode the binary packet\n");
+      closeConn(w, fd);
+      return(0);
+    }
+  } else {
+    jobj = json_tokener_parse(in->buf);
+  }
+  if(jobj == NULL) {
+    printf("Not able to parse the packet\n");
+    ctype = -1;
+  } else {
+    // Looked up by name, registrations carry more keys than CONN_TYPE now
+    json_object *type = json_object_object_get(jobj, "CONN_TYPE");
+    ctype = (type != NULL) ? json_object_get_int(type) : -1;
+  }
   if(ctype == -1) {
     printf("Either not able to determine type or not a registration packet\n");
   } else {
-    sock_data[fd].ctype = ctype;
+    w->sock_data[fd].ctype = ctype;
     is_reg_pkt = 1;
     //printf("Conn type - %d on sock - %d\n",ctype, fd);
+
+    // Binary from the reply to this on, if asked for
+    const char *encoding = json_object_get_string(json_object_object_get(jobj, "ENCODING"));
+    wire_conn_free(w->sock_data[fd].wire);
+    w->sock_data[fd].wire = NULL;
+    if(encoding != NULL && strcmp(encoding, WIRE_ENCODING) == 0)
+      w->sock_data[fd].wire = wire_conn_new(NULL);
+
+    // Replies compressed with the first codec it takes that we have
+    w->sock_data[fd].compress = compress_pick(json_object_get_string(json_object_object_get(jobj, "COMPRESS")));
   }
 
-  if (is_reg_pkt != 1) {
-  if(sock_data[fd].ctype == COLLECTOR) {
-
-      //printf("%s\n",sock_data[fd].accural_buf);
-      apphdr *app_h = (apphdr *) rbuf;
-      jobj = json_tokener_parse(sock_data[fd].accural_buf);
-      update_dbase(app_h->timestamp,app_h->nodename,jobj);
-      json_object_put(jobj);
-
-   } else if(sock_data[fd].ctype == APPLICATION) {
-
-      jobj = json_tokener_parse(sock_data[fd].accural_buf);
-      sock_data[fd].sqlite_cmd = malloc(MAX_SQL_SIZE); 
-      strcpy(sock_data[fd].sqlite_cmd,"select nodename,jsonblob from ");
-      strcat(sock_data[fd].sqlite_cmd,SQLITE_DB_TB1NAME);
-      strcat(sock_data[fd].sqlite_cmd," left join ");
-      strcat(sock_data[fd].sqlite_cmd,SQLITE_DB_TB2NAME);
-      strcat(sock_data[fd].sqlite_cmd," on ");
-      strcat(sock_data[fd].sqlite_cmd,SQLITE_DB_TB1NAME);
-      strcat(sock_data[fd].sqlite_cmd,".rowid = ");
-      strcat(sock_data[fd].sqlite_cmd,SQLITE_DB_TB2NAME);
-      strcat(sock_data[fd].sqlite_cmd,".blobid where ");
-      int len = strlen(sock_data[fd].sqlite_cmd);
-      strcat(sock_data[fd].sqlite_cmd, json_object_get_string(json_object_object_get(jobj, "sqlite_cmd")));
-      if (len == strlen(sock_data[fd].sqlite_cmd)) {
+  if (is_reg_pkt != 1 && jobj != NULL) {
+  if(w->sock_data[fd].ctype == COLLECTOR) {
+
+      //printf("%s\n",in->buf);
+      // Takes jobj, see nodetable_update()
+      nodetable_update(&nodes,in->hdr.nodename,in->hdr.timestamp,jobj);
+      jobj = NULL;
+
+   } else if(w->sock_data[fd].ctype == FORWARDER) {
+
+      // The nodes below another aggregator, see forwardLoop()
+
+      forwardUpdate(jobj, in->hdr.timestamp);
+
+   } else if(w->sock_data[fd].ctype == SUBSCRIBE) {
+
+      // A (new) filter to push changes of nodes by
+
+      w->sock_data[fd].request = json_object_get(jobj);
+
+   } else if(w->sock_data[fd].ctype == APPLICATION && (json_object_object_get(jobj, "history") != NULL ||
+             json_object_object_get(jobj, "filter") != NULL || json_object_object_get(jobj, "nodes") != NULL)) {
+
+      // Answered from the node table, SQL is left for whatever else
+
+      w->sock_data[fd].request = json_object_get(jobj);
+
+   } else if(w->sock_data[fd].ctype == APPLICATION) {
+
+      w->sock_data[fd].sqlite_cmd = malloc(MAX_SQL_SIZE); 
+      strcpy(w->sock_data[fd].sqlite_cmd,"select nodename,jsonblob from ");
+      strcat(w->sock_data[fd].sqlite_cmd,SQLITE_DB_TB1NAME);
+      strcat(w->sock_data[fd].sqlite_cmd," left join ");
+      strcat(w->sock_data[fd].sqlite_cmd,SQLITE_DB_TB2NAME);
+      strcat(w->sock_data[fd].sqlite_cmd," on ");
+      strcat(w->sock_data[fd].sqlite_cmd,SQLITE_DB_TB1NAME);
+      strcat(w->sock_data[fd].sqlite_cmd,".rowid = ");
+      strcat(w->sock_data[fd].sqlite_cmd,SQLITE_DB_TB2NAME);
+      strcat(w->sock_data[fd].sqlite_cmd,".blobid where ");
+      int len = strlen(w->sock_data[fd].sqlite_cmd);
+      strcat(w->sock_data[fd].sqlite_cmd, json_object_get_string(json_object_object_get(jobj, "sqlite_cmd")));
+      if (len == strlen(w->sock_data[fd].sqlite_cmd)) {
 	//App sent an empty SQL command so we need to return all JSONs we have
-	strcpy(sock_data[fd].sqlite_cmd,"select nodename,jsonblob from ");
-	strcat(sock_data[fd].sqlite_cmd,SQLITE_DB_TB1NAME);
+	free(w->sock_data[fd].sqlite_cmd);
+	w->sock_data[fd].sqlite_cmd = NULL;
+	w->sock_data[fd].query_all = 1;
       }
    } 
    }
 
-  if(sock_data[fd].accural_buf != NULL){
-    free(sock_data[fd].accural_buf);
+  if(jobj != NULL) json_object_put(jobj);
+  frame_reset(in);
+
+  // One response per request
+  if(queueReply(w, fd, is_reg_pkt) < 0)
+    return(0);
   }
-  FD_CLR(fd, &rfds);
-  FD_SET(fd, &wfds);
+
   return(0);
 }
 
+// A UDP socket bound to port, see setupSockets()
 int
-setupSockets(int port,int *stcp,int *sudp)
+setupUDP(int port,int reuseport)
 {
+  int sudp;
+  int n = 1;
 
-  // new TCP socket
-  if((*stcp = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-    perror("TCP socket");
+  if((sudp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+    perror("UDP socket");
+    return -1;
+  }
+  if(setsockopt(sudp, SOL_SOCKET, SO_REUSEADDR, (char *)&n, sizeof(n)) < 0) {
+    perror("UDP setsockopt");
     return -1;
   }
+  if(reuseport) {
+#ifdef SO_REUSEPORT
+    if(setsockopt(sudp, SOL_SOCKET, SO_REUSEPORT, (char *)&n, sizeof(n)) < 0) {
+      perror("UDP setsockopt");
+      return -1;
+    }
+#else
+    fprintf(stderr, "SO_REUSEPORT is not supported on this system\n");
+    return -1;
+#endif
+  }
 
-  // new UDP socket
-  if((*sudp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
-    perror("UDP socket");
+  // room for the samples of many collectors reporting at once
+  n = UDP_RCVBUF;
+  if(setsockopt(sudp, SOL_SOCKET, SO_RCVBUF, (char *)&n, sizeof(n)) < 0) {
+    perror("UDP setsockopt");
+  }
+
+  struct sockaddr_in sin;
+  bzero(&sin, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = INADDR_ANY;
+  if(bind(sudp, (struct sockaddr*) &sin, sizeof(sin)) < 0) {
+    perror("UDP bind");
+    return -1;
+  }
+
+  if(set_nonblocking(sudp) < 0) {
+    return -1;
+  }
+  return(sudp);
+}
+
+int
+setupSockets(int port,int *stcp,int *sudp,int reuseport)
+{
+
+  // new TCP socket
+  if((*stcp = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+    perror("TCP socket");
     return -1;
   }
 
@@ -326,9 +794,19 @@ setupSockets(int port,int *stcp,int *sudp)
     perror("TCP setsockopt");
     return -1;
   }
-  if(setsockopt(*sudp, SOL_SOCKET, SO_REUSEADDR, (char *)&n, sizeof(n)) < 0) {
-    perror("UDP setsockopt");
+
+  // let every worker bind its own sockets to the same port,
+  // the kernel then spreads connections and datagrams across them
+  if(reuseport) {
+#ifdef SO_REUSEPORT
+    if(setsockopt(*stcp, SOL_SOCKET, SO_REUSEPORT, (char *)&n, sizeof(n)) < 0) {
+      perror("TCP setsockopt");
+      return -1;
+    }
+#else
+    fprintf(stderr, "SO_REUSEPORT is not supported on this system\n");
     return -1;
+#endif
   }
 
   // bind socket to some port
@@ -341,13 +819,19 @@ setupSockets(int port,int *stcp,int *sudp)
     perror("TCP bind");
     return -1;
   }
-  if(bind(*sudp, (struct sockaddr*) &sin, sizeof(sin)) < 0) {
-    perror("UDP bind");
+
+  // new UDP socket, same port
+  if((*sudp = setupUDP(port, reuseport)) < 0) {
+    return -1;
+  }
+
+  // Both are serviced by an edge triggered event loop
+  if(set_nonblocking(*stcp) < 0) {
     return -1;
   }
 
   // listen for incoming connections
-  if(listen(*stcp, 5) < 0) {
+  if(listen(*stcp, SOMAXCONN) < 0) {
     perror("TCP listen");
     return -1;
   }
@@ -355,8 +839,30 @@ setupSockets(int port,int *stcp,int *sudp)
   return(0);
 }
 
+// Out of fds: give up the spare one for long enough to take the next
+// connection off the backlog and close it, so the client sees it refused
+// instead of hanging and the backlog doesn't fill up with them. Without
+// a spare, accepts wait for the next tick like when out of memory.
+static int
+refuseConn(worker *w, int fd)
+{
+  int c;
+
+  if(w->spare < 0) {
+    w->accept_paused = 1;
+    return ACCEPT_DRAINED;
+  }
+  close(w->spare);
+  c = accept(fd, NULL, NULL);
+  if(c >= 0) close(c);
+  w->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return (c >= 0) ? ACCEPT_SKIPPED : ACCEPT_DRAINED;
+}
+
+// Take the next connection off the backlog of the listen socket fd.
+// Returns its fd, or one of ACCEPT_DRAINED, ACCEPT_SKIPPED & ACCEPT_FATAL.
 int
-acceptConn(int fd)
+acceptConn(worker *w, int fd)
 {
   struct sockaddr_in sin;
   socklen_t sinlen = sizeof(sin);
@@ -364,41 +870,431 @@ acceptConn(int fd)
 
   int c;
 
-  if((c = accept(fd, (struct sockaddr*) &sin, &sinlen)) < 0) {
+  while((c = accept(fd, (struct sockaddr*) &sin, &sinlen)) < 0 && errno == EINTR);
+  if(c < 0) {
+    switch(errno) {
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+      return ACCEPT_DRAINED;
+    case ECONNABORTED:
+    case EPROTO:
+    case EPERM:
+      return ACCEPT_SKIPPED;
+    case EMFILE:
+    case ENFILE:
+      fprintf(stderr, "Out of file descriptors, refusing a connection\n");
+      return refuseConn(w, fd);
+    case ENOBUFS:
+    case ENOMEM:
+      perror("accept");
+      w->accept_paused = 1;
+      return ACCEPT_DRAINED;
+    }
     perror("accept");
-    return -1;
+    return ACCEPT_FATAL;
+  }
+  if(sockdata_reserve(w, c) < 0 || set_nonblocking(c) < 0) {
+    close(c);
+    return ACCEPT_SKIPPED;
   }
-  strcpy(sock_data[c].remote_sock_ipaddr,inet_ntoa(sin.sin_addr));
+  strcpy(w->sock_data[c].remote_sock_ipaddr,inet_ntoa(sin.sin_addr));
 
-  fprintf(stderr,"Accepted a new connection on fd - %d from %s\n",c,sock_data[c].remote_sock_ipaddr);
+  fprintf(stderr,"Accepted a new connection on fd - %d from %s\n",c,w->sock_data[c].remote_sock_ipaddr);
 
   // Initialize all the variables
   // Connection type unknown at this time
-  sock_data[c].ctype = UNKNOWN;
-  sock_data[c].r_payloadlen = 0;
-  sock_data[c].sqlite_cmd = NULL;
-  sock_data[c].accural_buf = NULL;
-
-  // Register interest in a read on this socket to know more about the connection.
-  FD_SET(c, &rfds);
+  w->sock_data[c].ctype = UNKNOWN;
+  w->sock_data[c].sqlite_cmd = NULL;
+
+  // Register interest in a read on this socket to know more about the connection,
+  // and in writes so queued replies go out as soon as there is room.
+  struct epoll_event ev;
+  bzero(&ev, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.fd = c;
+  if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, c, &ev) < 0) {
+    perror("epoll_ctl");
+    closeConn(w, c);
+    return ACCEPT_SKIPPED;
+  }
   
   return(c);
 }
 
+void *
+workerLoop(void *arg)
+{
+  worker *w = (worker *) arg;
+  int stcp = w->stcp;
+  int sudp = w->sudp;
+
+  // Event loop
+  struct epoll_event events[EPOLL_MAXEVENTS];
+  while(1) {
+    int c;
+
+    int n = 0;
+
+    // Block until there's an event to handle
+    // Return value 'n' gives the number of FDs ready to be serviced
+    if((n = epoll_wait(w->epfd, events, EPOLL_MAXEVENTS, -1)) < 0) {
+      if(errno == EINTR) continue;
+      perror("epoll_wait");
+      exit(1);
+    }
+ 
+    // Handle events, only the ready ones are handed to us
+    for(int j = 0; j < n; j++) {
+      int i = events[j].data.fd;
+      uint32_t revents = events[j].events;
+
+      // Handle our main mother, TCP listening socket differently
+      if(i == stcp) {
+	w->accept_paused = 0;
+	while((c = acceptConn(w, stcp)) > 0 || c == ACCEPT_SKIPPED);
+	if(c == ACCEPT_FATAL)
+	  exit(1);
+	continue;
+      }
+      // Handle our UDP socket differently
+      if(i == sudp || i == w->sleg) {
+	readUDP(w, i);
+	continue;
+      }
+      // Time to look for changes subscribers want
+      if(i == w->tfd) {
+	uint64_t ticks;
+	while(read(w->tfd, &ticks, sizeof(ticks)) > 0);
+	pushUpdates(w);
+	// No new edge comes for connections left in the backlog
+	if(w->accept_paused) {
+	  w->accept_paused = 0;
+	  while((c = acceptConn(w, stcp)) > 0 || c == ACCEPT_SKIPPED);
+	  if(c == ACCEPT_FATAL)
+	    exit(1);
+	}
+	continue;
+      }
+
+      if((revents & (EPOLLERR | EPOLLHUP)) && !(revents & EPOLLIN)) {
+	closeConn(w, i);
+	continue;
+      }
+
+      int resume = 0;
+      if(revents & EPOLLOUT) {
+	fprintf(stderr,"File descriptor %d is ready for writing .. call'g writeHLR\n",i);
+	if((resume = writeHandler(w, i)) < 0)
+	  continue;
+      }
+      if((revents & EPOLLIN) || resume) {
+	fprintf(stderr,"File descriptor %d is ready for reading .. call'g readHLR\n",i);
+	readHandler(w, i);
+      }
+    }
+  }
+  return(NULL);
+}
+
+// Write the nodes that changed to the database every NODETABLE_FLUSH
+// seconds, all in one transaction. Also drops the history of nodes that
+// went quiet every HISTORY_EXPIRE seconds.
+void *
+flushLoop(void *arg)
+{
+  nodeflush *f;
+  int n;
+  time_t expired = time(NULL);
+
+  while(1) {
+    sleep(NODETABLE_FLUSH);
+
+    if(time(NULL) - expired >= HISTORY_EXPIRE) {
+      expired = time(NULL);
+      nodetable_expire(&nodes, expired - history_nslots() * HISTORY_STEP);
+      if(qcache_enabled(&cache))
+        printf("Query cache: %lu hits, %lu misses\n", cache.hits, cache.misses);
+    }
+
+    if((n = nodetable_take_dirty(&nodes, &f)) == 0)
+      continue;
+
+    pthread_mutex_lock(&db_lock);
+    for(int i = 0; i < n; i++) {
+      dbstore_put(&store, f[i].nodename, f[i].timestamp, f[i].blob);
+    }
+    dbstore_commit(&store);
+    __atomic_add_fetch(&dbgen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&db_lock);
+
+    nodetable_free_dirty(f, n);
+  }
+  return(NULL);
+}
+
+// Send the aggregator at upstream_host what changed of our nodes every
+// forward_interval seconds, as one batch in the format of a push to a
+// subscriber of all nodes. A node changing many times in between is sent
+// once, as it is by then. So a tree of aggregators adds up to one that
+// has every node, while none holds more sockets than it has children.
+void *
+forwardLoop(void *arg)
+{
+  json_object *req = json_object_new_object();
+  subscription *sub = NULL;
+  outqueue q;
+  char err[MAX_SQL_SIZE];
+  char *rbuf;
+  int sock = -1;
+  time_t resync = 0;
+
+  bzero(&q, sizeof(q));
+  json_object_object_add(req, "interval", json_object_new_int(forward_interval));
+
+  while(1) {
+    sleep(forward_interval);
+
+    // It only ever answers, so anything to read means it went away
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    if(sock >= 0 && poll(&pfd, 1, 0) > 0) {
+      fprintf(stderr, "Lost the connection to %s:%d\n", upstream_host, upstream_port);
+      close(sock);
+      sock = -1;
+    }
+
+    if(sock < 0) {
+      if((sock = setup_ConnectSocket(upstream_host, upstream_port)) < 0)
+        continue;
+      registerConntype(sock, FORWARDER, NULL);
+      if((rbuf = recvall(sock)) == NULL) {
+        close(sock);
+        sock = -1;
+        continue;
+      }
+      free(rbuf);
+      printf("Forwarding to %s:%d\n", upstream_host, upstream_port);
+      // Starting over with all of them
+      subscribe_free(sub);
+      sub = NULL;
+    }
+
+    // All of them again now and then, should the upstream have lost any
+    time_t now = time(NULL);
+    if(sub == NULL || now >= resync) {
+      subscribe_free(sub);
+      if((sub = subscribe_new(req, err, sizeof(err))) == NULL) {
+        fprintf(stderr, "Not able to forward: %s\n", err);
+        continue;
+      }
+      resync = now + FORWARD_RESYNC;
+    }
+
+    json_object *batch = json_object_new_object();
+    int rval = 0;
+    if(subscribe_push(sub, &nodes, now, 0, batch) > 0) {
+      if((rval = outq_add_json(&q, batch, hostname)) == 0) {
+        // Blocking, all of it goes out or the connection failed
+        rval = sendall(sock, q.buf + q.off, outq_pending(&q));
+        q.off = q.len;
+      }
+      if(rval == 0 && (rbuf = recvall(sock)) != NULL)
+        free(rbuf);
+      else
+        rval = -1;
+    }
+    json_object_put(batch);
+
+    if(rval != 0) {
+      fprintf(stderr, "Lost the connection to %s:%d\n", upstream_host, upstream_port);
+      close(sock);
+      sock = -1;
+    }
+  }
+  return(NULL);
+}
+
+int
+setupWorker(worker *w, int reuseport)
+{
+  if(sockdata_reserve(w, 0) < 0)
+    return -1;
+
+  // Kept for when we run out of fds, see refuseConn()
+  if((w->spare = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+    perror("/dev/null");
+    return -1;
+  }
+
+  if((w->epfd = epoll_create1(0)) < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+
+  // Open TCP (SOCK_STREAM) & UDP (SOCK_DGRAM) sockets, bind to the port 
+  // given and listen on TCP sock for connections
+  if((setupSockets(w->port,&w->stcp,&w->sudp,reuseport)) < 0)
+    return -1;
+
+  printf("Worker %d listen sock # is - %d & UDP sock # is - %d \n",w->id,w->stcp,w->sudp);
+
+  // wulfd packets on a port of their own
+  w->sleg = -1;
+  if(legacy_port > 0) {
+    if((w->sleg = setupUDP(legacy_port, reuseport)) < 0)
+      return -1;
+    printf("Worker %d takes wulfd packets on UDP sock # %d\n",w->id,w->sleg);
+  }
+
+  // Buffers of readUDP(), set up once
+  w->udpmsgs = calloc(UDP_BATCH, sizeof(struct mmsghdr));
+  w->udpiov = calloc(UDP_BATCH, sizeof(struct iovec));
+  w->udpaddrs = calloc(UDP_BATCH, sizeof(struct sockaddr_in));
+  w->udpbufs = malloc(UDP_BATCH * (UDP_MAXDGRAM + 1));
+  if(w->udpmsgs == NULL || w->udpiov == NULL || w->udpaddrs == NULL || w->udpbufs == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  for(int i = 0; i < UDP_BATCH; i++) {
+    w->udpiov[i].iov_base = w->udpbufs + i * (UDP_MAXDGRAM + 1);
+    w->udpiov[i].iov_len = UDP_MAXDGRAM;
+    w->udpmsgs[i].msg_hdr.msg_iov = &w->udpiov[i];
+    w->udpmsgs[i].msg_hdr.msg_iovlen = 1;
+    w->udpmsgs[i].msg_hdr.msg_name = &w->udpaddrs[i];
+  }
+  json_object *keys = wire_keys();
+  if(wire_dict_init(&w->udpdict) < 0) {
+    json_object_put(keys);
+    return -1;
+  }
+  for(int i = 0; i < json_object_array_length(keys); i++) {
+    if(wire_dict_add(&w->udpdict, json_object_get_string(json_object_array_get_idx(keys, i))) < 0) {
+      json_object_put(keys);
+      return -1;
+    }
+  }
+  json_object_put(keys);
+  w->udpkeys = w->udpdict.nnames;
+
+  //Add the created TCP & UDP sockets to the epoll set
+  struct epoll_event ev;
+  bzero(&ev, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = w->stcp;
+  if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->stcp, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  ev.data.fd = w->sudp;
+  if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sudp, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  ev.data.fd = w->sleg;
+  if(w->sleg >= 0 && epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sleg, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+
+  // Subscribers are pushed to from the event loop, woken by this timer
+  struct itimerspec tick;
+  bzero(&tick, sizeof(tick));
+  tick.it_value.tv_sec = tick.it_interval.tv_sec = SUBSCRIBE_TICK;
+  if((w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+     timerfd_settime(w->tfd, 0, &tick, NULL) < 0) {
+    perror("timerfd");
+    return -1;
+  }
+  ev.data.fd = w->tfd;
+  if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->tfd, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s [-w workers] [-H seconds] [-a dir] [-r levels] [-c ms] [-u host:port [-f seconds]] [-l port] [port]\n", prog);
+  fprintf(stderr, "  -w workers   # of threads, each with its own listen socket (default 1)\n");
+  fprintf(stderr, "  -H seconds   history kept per node at %ds resolution (default %d)\n", HISTORY_STEP, HISTORY_SECS);
+  fprintf(stderr, "  -a dir       archive each node's history in dir, \"\" for none (default %s)\n", RRA_DIR);
+  fprintf(stderr, "  -r levels    step:slots of each archive, finest first (default %s)\n", RRA_LEVELS);
+  fprintf(stderr, "  -c ms        answer a repeated query from cache for up to ms after its\n");
+  fprintf(stderr, "               data changed, 0 only while unchanged, -1 never (default %d)\n", QCACHE_TTL);
+  fprintf(stderr, "  -u host:port forward every node to the aggregator there, which sees\n");
+  fprintf(stderr, "               this one as a collector of all of them\n");
+  fprintf(stderr, "  -f seconds   between batches of changes forwarded (default %d)\n", FORWARD_INTERVAL);
+  fprintf(stderr, "  -l port      also take the packets of legacy wulfd on this UDP port,\n");
+  fprintf(stderr, "               which it sends to (%d) instead of warewulfd\n", LEGACY_PORT);
+  exit(1);
+}
+
 int
 main(int argc, char *argv[])
 {
-  int stcp = -1;
-  int sudp = -1;
-	
   int rc = -1;
+  int nworkers = 1;
+  char *rradir = RRA_DIR;
+  char *rralevels = RRA_LEVELS;
+  int cachettl = QCACHE_TTL;
+  char *p;
+  int c;
 
-  if(argc != 2) {
-    fprintf(stderr, "Usage: %s [port]\n", argv[0]);
-    exit(1);
+  while((c = getopt(argc, argv, "w:H:a:r:c:u:f:l:h")) != -1) {
+    switch(c) {
+    case 'w':
+      nworkers = atoi(optarg);
+      if(nworkers < 1) usage(argv[0]);
+      break;
+    case 'H':
+      if(history_setup(atoi(optarg)) < 0) usage(argv[0]);
+      break;
+    case 'a':
+      rradir = optarg;
+      break;
+    case 'r':
+      rralevels = optarg;
+      break;
+    case 'c':
+      cachettl = atoi(optarg);
+      break;
+    case 'u':
+      upstream_host = optarg;
+      if((p = strrchr(optarg, ':')) == NULL || (upstream_port = atoi(p + 1)) <= 0)
+        usage(argv[0]);
+      *p = '\0';
+      break;
+    case 'l':
+      legacy_port = atoi(optarg);
+      if(legacy_port <= 0) usage(argv[0]);
+      break;
+    case 'f':
+      forward_interval = atoi(optarg);
+      if(forward_interval < 1) usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if(argc - optind != 1) {
+    usage(argv[0]);
   }
+  int port = atoi(argv[optind]);
+
+  struct utsname unameinfo;
+  uname(&unameinfo);
+  strncpy(hostname, unameinfo.nodename, MAX_NODENAME_LEN-1);
 
-  bzero(sock_data,sizeof(sock_data));
+  // Every collector holds a connection open, so allow as many as we can
+  struct rlimit rl;
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
 
   // Get the database ready
   // Attempt to open database & check for failure
@@ -411,64 +1307,55 @@ main(int argc, char *argv[])
   // Now check & create tables if required 
     createTable(db,SQLITE_DB_TB1NAME);
     createTable(db,SQLITE_DB_TB2NAME);
+    if(dbstore_open(&store, db) < 0) {
+      sqlite3_close(db);
+      exit(1);
+    }
     printf("Database ready for reading and writing...\n");
   }
 
-  // Prepare to accept clients
-  FD_ZERO(&rfds);
-  FD_ZERO(&wfds);
+  if(*rradir != '\0' && rra_setup(rradir, rralevels) == 0)
+    printf("Archiving history in %s at %s\n", rradir, rralevels);
 
-  // Open TCP (SOCK_STREAM) & UDP (SOCK_DGRAM) sockets, bind to the port 
-  // given and listen on TCP sock for connections
-  if((setupSockets(atoi(argv[1]),&stcp,&sudp)) < 0)
+  if(nodetable_init(&nodes) < 0 || qcache_init(&cache, cachettl) < 0)
     exit(1);
+  printf("Loaded %d nodes from the database\n", nodetable_load(&nodes, db));
+  printf("Keeping %d samples of history per node, %zu KB for every 1000 nodes\n",
+         history_nslots(), history_node_size() * 1000 / 1024);
 
-  printf("Our listen sock # is - %d & UDP sock # is - %d \n",stcp,sudp);
-  //printf("FD_SETSIZE - %d\n",FD_SETSIZE);
-
-  //Add the created TCP & UDP sockets to the read set of file descriptors
-  FD_SET(stcp, &rfds);
-  FD_SET(sudp, &rfds);
-
-  // Event loop
-  while(1) {
-
-    int n = 0;
-    fd_set _rfds, _wfds;
+  pthread_t flusher;
+  if(pthread_create(&flusher, NULL, flushLoop, NULL) != 0) {
+    perror("pthread_create");
+    exit(1);
+  }
 
-    memcpy(&_rfds, &rfds, sizeof(fd_set));
-    memcpy(&_wfds, &wfds, sizeof(fd_set));
+  pthread_t forwarder;
+  if(upstream_host != NULL && pthread_create(&forwarder, NULL, forwardLoop, NULL) != 0) {
+    perror("pthread_create");
+    exit(1);
+  }
 
-    // Block until there's an event to handle
-    // Select function call is made; return value 'n' gives the number of FDs ready to be serviced
-    if(((n = select(FD_SETSIZE, &_rfds, &_wfds, NULL, 0)) < 0) && 
-       (errno != EINTR)) {
-      perror("select");
+  // Prepare to accept clients
+  worker *workers = calloc(nworkers, sizeof(worker));
+  if(workers == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  for(int i = 0; i < nworkers; i++) {
+    workers[i].id = i;
+    workers[i].port = port;
+    if(setupWorker(&workers[i], nworkers > 1) < 0)
       exit(1);
-    }
- 
-    // Handle events
-    for(int i = 0; (i < FD_SETSIZE) && n ; i++) {
+  }
 
-      if(FD_ISSET(i, &_rfds)) {
-	// Handle our main mother, TCP listening socket differently
-	if(i == stcp) {
-	  if(acceptConn(stcp) < 0)
-	    exit(1);
-        // Handle our UDP socket differently
-        } else if(i == sudp) {
-          readndumpData(sudp);
-        } else {
-	  fprintf(stderr,"File descriptor %d is ready for reading .. call'g readHLR\n",i);
-          readHandler(i);
-	}
-	n--;
-      }
-      if(FD_ISSET(i, &_wfds)) {
-	  fprintf(stderr,"File descriptor %d is ready for writing .. call'g writeHLR\n",i);
-	  writeHandler(i);
-	n--;
-      } 
+  // The main thread serves as worker 0
+  for(int i = 1; i < nworkers; i++) {
+    if(pthread_create(&workers[i].tid, NULL, workerLoop, &workers[i]) != 0) {
+      perror("pthread_create");
+      exit(1);
     }
   }
+  workerLoop(&workers[0]);
+
+  return(0);
 }
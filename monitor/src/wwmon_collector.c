@@ -10,9 +10,11 @@
  *
  */
 
+#define _GNU_SOURCE  // sched_setaffinity()
 
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -26,74 +28,558 @@
 #include <fcntl.h>
 #include <time.h>
 #include <ctype.h>
+#include <math.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/utsname.h>
 #include <json/json.h>
 #include <sqlite3.h>
 
 #include "getstats.h"
 #include "util.h"
+#include "wire.h"
+#include "ring.h"
+#include "sampler.h"
 #include "config.h"
 
 #define PROGRAM_TYPE COLLECTOR
 
+// Per metric thresholds, as given by -T, all others use the -t one
+static char thresh_keys[DELTA_MAXKEYS][MAX_NODENAME_LEN];
+static double thresh_vals[DELTA_MAXKEYS];
+static double thresh_slack[DELTA_MAXKEYS];
+static int nthresh;
+static double thresh = DELTA_THRESH;
+
+// Metric families broken down by cpu and by interface, as given by -B
+static int percpu;
+static int perif;
+
+// Whether to say what we do, not with -J
+static int verbose = 1;
+
+// Parse cpu|net[,cpu|net]
+static int
+parse_breakdown(char *list)
+{
+  char *saveptr, *item;
+
+  for (item = strtok_r(list, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+    if (strcmp(item, "cpu") == 0) percpu = 1;
+    else if (strcmp(item, "net") == 0) perif = 1;
+    else return(-1);
+  }
+  return(0);
+}
+
+// Parse KEY=fraction[+slack][,KEY=fraction[+slack]]...
+static int
+parse_thresholds(char *list)
+{
+  char *saveptr, *item;
+
+  for (item = strtok_r(list, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+    char *eq = strchr(item, '=');
+    if (eq == NULL || nthresh == DELTA_MAXKEYS || eq - item >= MAX_NODENAME_LEN) return(-1);
+    *eq = '\0';
+    strcpy(thresh_keys[nthresh], item);
+    thresh_vals[nthresh] = strtod(eq + 1, &eq);
+    thresh_slack[nthresh++] = (*eq == '+') ? strtod(eq + 1, NULL) : 0;
+  }
+  return(0);
+}
+
+// How far the metric may move from b before it is sent again. Integer
+// metrics (percents, MB, KB/s) get DELTA_SLACK on top unless -T says
+// otherwise, like wulfd had, so idle nodes flickering by 1 stay quiet.
+static double
+threshold(const char *key, json_object *val, double b)
+{
+  for (int i = 0; i < nthresh; i++) {
+    if (strcmp(thresh_keys[i], key) == 0) return(fabs(b) * thresh_vals[i] + thresh_slack[i]);
+  }
+  return(fabs(b) * thresh + (json_object_get_type(val) == json_type_int ? DELTA_SLACK : 0));
+}
+
+static int
+as_number(json_object *val, double *num)
+{
+  char *end;
+
+  switch (json_object_get_type(val)) {
+  case json_type_int:
+    *num = json_object_get_int(val);
+    return(1);
+  case json_type_double:
+    *num = json_object_get_double(val);
+    return(1);
+  case json_type_string:
+    *num = strtod(json_object_get_string(val), &end);
+    return(end != json_object_get_string(val) && *end == '\0');
+  default:
+    return(0);
+  }
+}
+
+// Whether the numbers of array a moved from those of b by more than
+// their threshold, element by element. -1 if they aren't both arrays of
+// numbers of the same length.
+static int
+array_moved(const char *key, json_object *a, json_object *b)
+{
+  int n = json_object_array_length(a);
+  double x, y;
+
+  if (json_object_get_type(b) != json_type_array || json_object_array_length(b) != n) return(-1);
+  for (int i = 0; i < n; i++) {
+    json_object *ai = json_object_array_get_idx(a, i), *bi = json_object_array_get_idx(b, i);
+    if (json_object_get_type(ai) == json_type_string || !as_number(ai, &x) || !as_number(bi, &y)) return(-1);
+    if (fabs(x - y) > threshold(key, ai, y)) return(1);
+  }
+  return(0);
+}
+
+// What of now the aggregator doesn't have yet: TIMESTAMP, and every metric
+// that moved by more than its threshold (a fraction of the value it was
+// last sent with, see threshold()) or isn't a number and changed. The
+// arrays of -B are numbers too, they are sent once any one of them
+// moved. Like wulfd did, samples in between don't count, a slow drift is
+// sent once it adds up. What is sent is recorded in sent.
+static json_object *
+delta(json_object *now, json_object *sent)
+{
+  json_object *d = json_object_new_object();
+
+  json_object_object_add(d, "DELTA", json_object_new_int(1));
+  json_object_object_foreach(now, key, value) {
+    json_object *was = json_object_object_get(sent, key);
+    double a, b;
+
+    if (was != NULL && strcmp(key, "TIMESTAMP") != 0) {
+      int moved;
+      if (as_number(value, &a) && as_number(was, &b)) {
+        if (fabs(a - b) <= threshold(key, value, b)) continue;
+      } else if (json_object_get_type(value) == json_type_array &&
+                 (moved = array_moved(key, value, was)) >= 0) {
+        if (!moved) continue;
+      } else if (strcmp(json_object_to_json_string(value), json_object_to_json_string(was)) == 0) {
+        continue;
+      }
+    }
+    json_object_object_add(d, key, json_object_get(value));
+    json_object_object_add(sent, key, json_object_get(value));
+  }
+  return(d);
+}
+
+// Connect to member, "host:port", of the ring, over UDP if udp
+static int
+connect_member(const char *member, int udp)
+{
+  char host[256];
+  const char *colon = strrchr(member, ':');
+
+  if (colon == NULL || colon - member >= sizeof(host)) return(-1);
+  memcpy(host, member, colon - member);
+  host[colon - member] = '\0';
+  if (udp) return(setup_ConnectUDP(host, atoi(colon + 1)));
+  return(setup_ConnectSocket(host, atoi(colon + 1)));
+}
+
+// A sample as one datagram. The aggregator keeps nothing of ours between
+// them, so binary ones are encoded with the built in keys of wire only.
+static int
+send_sample(int sock, wireconn *wire, json_object *pkt)
+{
+  static wirebuf b;
+  const char *payload;
+  size_t len;
+  int flags = 0, rval;
+
+  if (wire != NULL) {
+    int keys = wire->out.nnames;
+    rval = wire_encode(&wire->out, pkt, &b);
+    wire_dict_trim(&wire->out, keys);
+    if (rval < 0) return(-1);
+    payload = b.buf;
+    len = b.len;
+    flags = APPHDR_BINARY;
+  } else {
+    payload = json_object_to_json_string(pkt);
+    len = strlen(payload);
+  }
+  if (sizeof(apphdr) + len > UDP_MAXDGRAM) {
+    if (verbose) printf("Sample of %zu bytes is too big for a datagram\n", len);
+    return(0);
+  }
+  return(send_frame(sock, payload, len, flags));
+}
+
+// Low jitter mode, for nodes running tightly coupled jobs: we stay on
+// the housekeeping cpu, wake at the same wall clock instant as every
+// other node (so all of us get in the way of a job at once, not each at
+// a time of its own) and sample in one burst out of memory that was
+// faulted in and locked beforehand. CYCLEUS says how long a burst took.
+// The sample is still a json-c object made and freed every time: its
+// allocations come out of the locked heap, they are not done away with.
+static int
+pin_cpu(int cpu)
+{
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+    perror("sched_setaffinity");
+    return(-1);
+  }
+  return(0);
+}
+
+static void
+lock_memory(void)
+{
+  // Freed memory is kept for the next sample, not given back and
+  // faulted in again
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) perror("mlockall");
+}
+
+// Till the wall clock is at the next multiple of ms, the same instant on
+// every node NTP keeps in step. Returns that instant, in ms.
+static long long
+wait_boundary(long ms)
+{
+  struct timespec ts;
+  long long at;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  at = ((ts.tv_sec * 1000LL + ts.tv_nsec / 1000000) / ms + 1) * ms;
+  ts.tv_sec = at / 1000;
+  ts.tv_nsec = (at % 1000) * 1000000;
+  while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR);
+  return(at);
+}
+
+static long
+usec_since(struct timespec *t0)
+{
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return((t1.tv_sec - t0->tv_sec) * 1000000 + (t1.tv_nsec - t0->tv_nsec) / 1000);
+}
+
+// Every metric of a sample into jobj
+static void
+sample(json_object *jobj)
+{
+  get_sysinfo(jobj);    // PROCS, UPTIME
+  get_cpu_info(jobj);   // CPUCOUNT, CPUCLOCK, CPUMODEL
+  get_uname(jobj);      // SYSNAME, NODENAME, RELEASE, VERSION, MACHINE
+  get_cpu_util(jobj);   // CPUUTIL
+  get_mem_stats(jobj);  // MEMTOTAL, MEMAVAIL, MEMUSED, MEMPERCENT, SWAPTOTAL, SWAPFREE, SWAPUSED, SWAPPERCENT
+  get_load_avg(jobj);   // LOADAVG
+  get_net_stats(jobj);  // NETTRANSMIT, NETRECEIVE
+  get_node_status(jobj);// NODESTATUS
+  if (percpu) get_cpu_util_percpu(jobj);  // CPUUTIL_CPU
+  if (perif) get_net_stats_perif(jobj);   // NETIF, NETRECEIVE_IF, NETTRANSMIT_IF
+}
+
+void
+usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s [-j] [-t fraction] [-T key=fraction,...] [-u seconds] aggregator_hostname port\n", prog);
+  fprintf(stderr, "       %s [options] [-m file] host:port[,host:port]...\n", prog);
+  fprintf(stderr, "  host:port    aggregators sharing the nodes, each node sends to the one its\n");
+  fprintf(stderr, "               name hashes to and fails over to the next ones on the ring\n");
+  fprintf(stderr, "  -m file      take them from the \"masters\" of file, like monitor.conf\n");
+  fprintf(stderr, "  -U           send every sample in full as one UDP datagram, no connection\n");
+  fprintf(stderr, "  -B list      also send by cpu and/or by interface, one array each: cpu (CPUUTIL_CPU),\n");
+  fprintf(stderr, "               net (NETIF with NETRECEIVE_IF & NETTRANSMIT_IF)\n");
+  fprintf(stderr, "  -r ms        sample cpu & network this often in between, send their\n");
+  fprintf(stderr, "               _MIN, _MAX, _MEAN and _LAST (a divisor of %d, at least %d)\n",
+          COLLECT_INTERVAL * 1000, SAMPLER_MINRATE);
+  fprintf(stderr, "  -J cpu       low jitter: run on this housekeeping cpu only, sample in one burst\n");
+  fprintf(stderr, "               at multiples of %d s of the wall clock, send CYCLEUS, print nothing;\n", COLLECT_INTERVAL);
+  fprintf(stderr, "               samples are still built with json-c, out of memory locked beforehand\n");
+  fprintf(stderr, "  -j           send JSON even to an aggregator that takes the binary encoding\n");
+  fprintf(stderr, "  -t fraction  send a metric again once it moved by this much (default %g)\n", DELTA_THRESH);
+  fprintf(stderr, "  -T list      key=fraction[+slack] thresholds of single metrics, 0 sends every change\n");
+  fprintf(stderr, "  -u seconds   send everything at least this often (default %d)\n", DELTA_REFRESH);
+  exit(1);
+}
+
 int main(int argc, char *argv[]){
   
-  if (argc != 3) {
-      fprintf(stderr,"Usage: %s aggregator_hostname [port] \n", argv[0]);
+  int refresh = DELTA_REFRESH;
+  const char *encoding = WIRE_ENCODING;
+  char *conffile = NULL;
+  int udp = 0;
+  int jitter_cpu = -1;      // Housekeeping cpu of the low jitter mode
+  int rate = 0;             // ms between fast samples, none if 0
+  static sampler fast;      // static, its rate table is big
+  ring members;
+  int c;
+
+  while ((c = getopt(argc, argv, "jt:T:u:m:UJ:r:B:h")) != -1) {
+    switch (c) {
+    case 'B':
+      if (parse_breakdown(optarg) < 0) usage(argv[0]);
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      if (rate < SAMPLER_MINRATE || (COLLECT_INTERVAL * 1000) % rate != 0) usage(argv[0]);
+      break;
+    case 'J':
+      jitter_cpu = atoi(optarg);
+      break;
+    case 'U':
+      udp = 1;
+      break;
+    case 'm':
+      conffile = optarg;
+      break;
+    case 'j':
+      encoding = NULL;
+      break;
+    case 't':
+      thresh = strtod(optarg, NULL);
+      break;
+    case 'T':
+      if (parse_thresholds(optarg) < 0) usage(argv[0]);
+      break;
+    case 'u':
+      refresh = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  // Our own cost moves by a few us every time, only send it when it really does
+  if (nthresh < DELTA_MAXKEYS) {
+    char sampledefault[] = "SAMPLECPU=1+50";
+    parse_thresholds(sampledefault);
+  }
+  if (jitter_cpu >= 0 && nthresh < DELTA_MAXKEYS) {
+    char cycledefault[] = "CYCLEUS=1+50";
+    parse_thresholds(cycledefault);
+  }
+
+  ring_init(&members, NULL, 0);
+  if (argc - optind == 2 && strchr(argv[optind+1], ':') == NULL) {
+      // A single aggregator, the way it always was given
+      char member[300];
+      snprintf(member, sizeof(member), "%s:%s", argv[optind], argv[optind+1]);
+      ring_parse(&members, member);
+  } else {
+      for (int i = optind; i < argc; i++) ring_parse(&members, argv[i]);
+  }
+  if (conffile != NULL && ring_load(&members, conffile) < 0) {
+      fprintf(stderr, "No masters in %s\n", conffile);
       exit(1);
   }
+  if (members.nmembers == 0) {
+      usage(argv[0]);
+  }
+
+  // Ours is the first aggregator after our name on the ring
+  struct utsname unameinfo;
+  uname(&unameinfo);
+  int *order = malloc(members.nmembers * sizeof(int));
+  if (order == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  int norder = ring_order(&members, unameinfo.nodename, order, members.nmembers);
+  int member = 0;           // Index into order of the one we send to
+  time_t connected = 0;
 
-  int sock; 
+  int sock = -1;
 
   time_t timer;
   char *rbuf;
   json_object *jobj;
+  json_object *sent = NULL; // What the aggregator has of us
+  time_t full = 0;          // When all of it was last sent
+  wireconn *wire = NULL;    // Once the aggregator took our encoding
+  int registering = 0;      // Till the reply to registering is read
+
+  // Over UDP binary from the start, nothing is negotiated
+  if(udp && encoding != NULL) wire = wire_conn_new(NULL);
+
+  if(rate > 0) {
+    // The base the first rates are worked out from
+    sampler_init(&fast);
+    sampler_tick(&fast);
+  }
+
+  long cycle = -1;          // us the last burst took, low jitter mode only
+  struct timespec woke;
+  if(jitter_cpu >= 0) {
+    if(pin_cpu(jitter_cpu) < 0) exit(1);
+    // A sample thrown away, so files are open, their buffers big enough
+    // and what never changes read, before the memory is locked
+    jobj = json_object_new_object();
+    sample(jobj);
+    json_object_put(jobj);
+    lock_memory();
+    verbose = 0;
+  }
 
   int setup_connection = 1;
   while(1) {
+    clock_gettime(CLOCK_MONOTONIC, &woke);
 
-    if(setup_connection == 1) {
-      if((sock=setup_ConnectSocket(argv[1], atoi(argv[2])))<0) {
-        printf("Will poll after some time \n");
+    if(setup_connection == 1 && udp) {
+      // Nothing says whether it is up till a datagram is refused, which
+      // moves us on to the next one
+      if((sock = connect_member(members.members[order[member]], 1)) < 0) {
+        member = (member + 1) % norder;
+      } else {
+        if(verbose) printf("Sending to %s\n", members.members[order[member]]);
+        connected = time(NULL);
+        setup_connection = 0;
+      }
+    } else if(setup_connection == 1) {
+      // Ours, or the next one up that is
+      for(member = 0; member < norder; member++) {
+        if((sock = connect_member(members.members[order[member]], 0)) >= 0) break;
+      }
+      if(sock < 0) {
+        if(verbose) printf("Will poll after some time \n");
         //exit(1);
-      } else 
+      } else {
+        if(verbose) printf("Sending to %s\n", members.members[order[member]]);
+        connected = time(NULL);
+        // Registered once, every packet after this is data
+        registerConntype(sock,PROGRAM_TYPE,encoding);
         setup_connection = 0;
-    } else {
+        registering = 1;
+        if(sent != NULL) json_object_put(sent);
+        sent = NULL;
+        wire_conn_free(wire);
+        wire = NULL;
+      }
+    }
+    if(setup_connection == 0) {
 
-    registerConntype(sock,PROGRAM_TYPE);
-    rbuf = recvall(sock);
-    printf("Received - %s\n",rbuf);
+    if(!udp) {
+    if((rbuf = recvall(sock)) == NULL) {
+        if(verbose) printf("Closing sock\n");
+        close(sock);
+        sock = -1;
+        setup_connection = 1;
+        sleep(2);
+        continue;
+    }
+    if(verbose) printf("Received - %s\n",rbuf);
+    if(registering) {
+        // An aggregator that knows the binary encoding says so, with the
+        // keys it has ids for, older ones only ever take JSON
+        json_object *reply = json_tokener_parse(rbuf);
+        if(encoding != NULL && reply != NULL) {
+            const char *took = json_object_get_string(json_object_object_get(reply, "ENCODING"));
+            json_object *keys = json_object_object_get(reply, "KEYS");
+            if(took != NULL && strcmp(took, encoding) == 0 &&
+               keys != NULL && json_object_get_type(keys) == json_type_array)
+                wire = wire_conn_new(keys);
+        }
+        if(reply != NULL) json_object_put(reply);
+        registering = 0;
+    }
     free(rbuf);
+    }
 
     jobj = json_object_new_object();
 
-    timer = time(NULL);
+    // Not time(), that is read off a coarse clock and can still be the
+    // second before when we just woke at a boundary
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    timer = wall.tv_sec;
     json_object_object_add(jobj,"TIMESTAMP",json_object_new_int(timer));
 
-    get_sysinfo(jobj);    // PROCS, UPTIME
-    get_cpu_info(jobj);   // CPUCOUNT, CPUCLOCK, CPUMODEL
-    get_uname(jobj);      // SYSNAME, NODENAME, RELEASE, VERSION, MACHINE
-    get_cpu_util(jobj);   // CPUUTIL
-    get_mem_stats(jobj);  // MEMTOTAL, MEMAVAIL, MEMUSED, MEMPERCENT, SWAPTOTAL, SWAPFREE, SWAPUSED, SWAPPERCENT
-    get_load_avg(jobj);   // LOADAVG
-    get_net_stats(jobj);  // NETTRANSMIT, NETRECEIVE
-    get_node_status(jobj);// NODESTATUS
-
-    printf("%s\n", json_object_to_json_string(jobj));
-    int rval = 0;
-    if ( (rval = send_json(sock,jobj)) == ESPIPE ) {
+    struct timespec cpu0, cpu1;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+
+    sample(jobj);
+    if(rate > 0) sampler_summary(&fast, jobj);
+
+    // What sampling cost us, in us of CPU
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+    json_object_object_add(jobj,"SAMPLECPU",json_object_new_int((cpu1.tv_sec - cpu0.tv_sec) * 1000000 +
+                                                                 (cpu1.tv_nsec - cpu0.tv_nsec) / 1000));
+    // and the whole of the last burst, from waking to sending, in us of
+    // the clock on the wall
+    if(cycle >= 0)
+        json_object_object_add(jobj,"CYCLEUS",json_object_new_int(cycle));
+
+    // All of it on a new connection and every refresh seconds, in between
+    // only what changed enough
+    json_object *pkt;
+    if(udp || sent == NULL || timer - full >= refresh) {
+      if(sent != NULL) json_object_put(sent);
+      sent = json_object_get(jobj);
+      pkt = json_object_get(jobj);
+      full = timer;
+    } else {
+      pkt = delta(jobj, sent);
+    }
+
+    if(verbose) printf("%s\n", json_object_to_json_string(pkt));
+    int rval;
+    if(udp)
+        rval = send_sample(sock, wire, pkt);
+    else if(wire != NULL)
+        rval = send_wire(sock, &wire->out, pkt);
+    else
+        rval = send_json(sock, pkt);
+    if ( rval == ESPIPE ) {
         //printf("Remove pipe has been severed \n");
         setup_connection = 1;
+    } else if ( udp && rval != 0 ) {
+        // Refused, on to the next one on the ring
+        member = (member + 1) % norder;
+        setup_connection = 1;
     }
+    json_object_put(pkt);
     json_object_put(jobj);
+    if(jitter_cpu >= 0) cycle = usec_since(&woke);
+
+    // Back to ours once in a while, so the nodes spread out again
+    if(setup_connection == 0 && member > 0 && timer - connected >= RING_FAILBACK) {
+        member = 0;
+        setup_connection = 1;
+    }
 
     if(setup_connection == 1) {
-	printf("Closing sock\n");
+	if(verbose) printf("Closing sock\n");
 	close(sock);
+	sock = -1;
     }
     }
-    sleep(2);
+    if(rate > 0 && jitter_cpu >= 0) {
+        // The last of them at the boundary of the next send
+        long long at;
+        do {
+            at = wait_boundary(rate);
+            sampler_tick(&fast);
+        } while(at % (COLLECT_INTERVAL * 1000) != 0);
+    } else if(rate > 0) {
+        for(int t = 0; t < COLLECT_INTERVAL * 1000 / rate; t++) {
+            usleep(rate * 1000);
+            sampler_tick(&fast);
+        }
+    } else if(jitter_cpu >= 0) {
+        wait_boundary(COLLECT_INTERVAL * 1000);
+    } else {
+        sleep(COLLECT_INTERVAL);
+    }
   }
 
+  if(rate > 0) sampler_free(&fast);
   close(sock);
   return 0;
 }